@@ -7,3 +7,11 @@
 #define REPL_IN         "8=> "
 #define EXTENSION       ".pkl"          // pickle scripts extension
 #define EUPSILON        1e-6            // precision of the equality assertion between doubles
+#define ENV_INIT_SZ     4               // initial number of slots of an environment (doubles at 3/4 load)
+#define POOL_SLAB_SZ    65536           // bytes carved into pooled objects at a time (see pool.h)
+#define EVAL_MAX_DEPTH  100000          // deepest the VM's (heap allocated) call frames may nest before a call fails with an error
+#define EVAL_C_STACK    (4 << 20)       // bytes of the C stack evaluation may use before it fails with an error (see eval_stack_check)
+#define INT_CACHE_MIN   -128            // integers in [INT_CACHE_MIN, INT_CACHE_MAX] are shared, never allocated
+#define INT_CACHE_MAX   1024
+#define INLINE_MAX_SIZE 16              // most symbols, values and lists the body of a function may have for its calls to be inlined (see lval_inline)
+#define INLINE_MAX_DEPTH 4              // how deep calls are inlined into the bodies inlined themselves
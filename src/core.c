@@ -1,6 +1,6 @@
 #include "core.h"
+#include "vm.h"
 
-static Lval_t* builtin_op(Lenv_t* e, Lval_t* a, char* op);
 static Lval_t* builtin_add(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_sub(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_mul(Lenv_t* e, Lval_t* a);
@@ -14,20 +14,33 @@ static Lval_t* builtin_tail(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_list(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_eval(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_join(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_len(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_nth(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_last(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_take(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_drop(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_in(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_map(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_filter(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_foldl(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_select(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_case(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_while(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_dotimes(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_for_each(Lenv_t* e, Lval_t* a);
 
 static Lval_t* builtin_lambda(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_fn(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_if(Lenv_t* e, Lval_t* a);
+static Lval_t* builtin_let(Lenv_t* e, Lval_t* a);
 
 static Lval_t* builtin_var(Lenv_t* e, Lval_t* a, char* fn);
 static Lval_t* builtin_def(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_put(Lenv_t* e, Lval_t* a);
 
-static Lval_t* builtin_cmp(Lenv_t* e, Lval_t* a, char* op);
 static Lval_t* builtin_eq(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_ne(Lenv_t* e, Lval_t* a);
 
-static Lval_t* builtin_ord(Lenv_t* e, Lval_t* a, char* op);
 static Lval_t* builtin_gt(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_lt(Lenv_t* e, Lval_t* a);
 static Lval_t* builtin_ge(Lenv_t* e, Lval_t* a);
@@ -48,30 +61,57 @@ static Lval_t* builtin_mktype(Lenv_t* e, Lval_t* a);
 
 static void    lenv_add_builtin_const(Lenv_t* e, char* name, Lval_t* val);
 static void    lenv_add_builtin(Lenv_t* e, char* name, Lbuiltin_t fn);
-static void    lenv_put(Lenv_t* e, Lval_t* k, Lval_t* v);
-static void    lenv_def(Lenv_t* e, Lval_t* k, Lval_t* v);
-static Lval_t* lenv_get(Lenv_t* e, Lval_t* k);
+static void    lenv_put_move(Lenv_t* e, Lval_t* k, Lval_t* v);
+static void    lenv_def_move(Lenv_t* e, Lval_t* k, Lval_t* v);
 static Lenv_t* lenv_copy(Lenv_t* e);
+static void    lenv_add_locals(Lenv_t* e, Lval_t* formals);
+static Lval_t* lenv_lookup(Lenv_t* e, char* sym);
+static void    lenv_put_global(Lenv_t* e, Lval_t* k, Lval_t* v);
 
 static Lval_t* lval_join(Lval_t* x, Lval_t* y);
 static Lval_t* lval_take(Lval_t* v, int i);
 static Lval_t* lval_pop(Lval_t* v, int i);
-static Lval_t* lval_call(Lenv_t* e, Lval_t* f, Lval_t* a);
-static Lval_t* lval_copy(Lval_t* v);
-static int     lval_eq(Lval_t* x, Lval_t* y);
+static Lval_t* lval_slice(Lval_t* v, int i, int n);
+static void    lval_cells_release(Lval_t* v);
+static bool    lval_formals_eq(Lfunc_t* x, Lfunc_t* y);
+static void    lval_formals_print(Lfunc_t* f);
 
 static Lval_t* lval_read_double(mpc_ast_t* ast);
 static Lval_t* lval_read_long(mpc_ast_t* ast);
 static Lval_t* lval_read_str(mpc_ast_t* ast);
+static Lval_t* lval_walk(Lenv_t* e, Lval_t* v);
 static Lval_t* lval_eval_sexpr(Lenv_t* e, Lval_t* v);
+static Lval_t* lval_eval_logic(Lenv_t* e, Lval_t* v);
+static Lval_t* lval_fold(Lenv_t* e, Lval_t* v);
+static void    lval_inline_func(Lfunc_t* f);
+static void    lval_inline_invalidate(char* sym);
+static void    sym_set_local(char* sym);
+
+/* every Lval_t, Lenv_t and descriptor comes from these pools (see pool.h) */
+static Lpool_t lval_pool = POOL_INIT(Lval_t);
+static Lpool_t lenv_pool = POOL_INIT(Lenv_t);
+static Lpool_t func_pool = POOL_INIT(Lfunc_t);
+static Lpool_t udt_pool  = POOL_INIT(Ludt_t);
+
+/*
+    Values that are never freed: the booleans, `ok`, `exit` and the small
+    integers, their count of owners starts too high to ever drop to 0 so
+    they're shared like any other value and copied by lval_unshare on write
+*/
+#define LVAL_IMMORTAL   (1 << 30)
+static Lval_t lval_true  = { .type = LVAL_BOOL, .refs = LVAL_IMMORTAL, .num.li = 1 };
+static Lval_t lval_false = { .type = LVAL_BOOL, .refs = LVAL_IMMORTAL, .num.li = 0 };
+static Lval_t lval_ok    = { .type = LVAL_OK,   .refs = LVAL_IMMORTAL };
+static Lval_t lval_exit  = { .type = LVAL_EXIT, .refs = LVAL_IMMORTAL };
+static Lval_t small_ints[INT_CACHE_MAX - INT_CACHE_MIN + 1];  // filled on first use
+
+/* the stack frame of the outermost `lval_eval` [NULL when not evaluating] */
+static char* eval_stack_base = NULL;
 
 /* memory allocators */
 static Lval_t* lval_create_ok(void);
 static Lval_t* lval_create_exit(void);
-static Lval_t* lval_create_bool(bool x);
 static Lval_t* lval_create_double(double x);
-static Lval_t* lval_create_long(long x);
-static Lval_t* lval_create_err(char* fmt, ...);
 static Lval_t* lval_create_sym(char* symbol);
 static Lval_t* lval_create_fn(Lbuiltin_t fn);
 static Lval_t* lval_create_lambda(Lval_t* formals, Lval_t* body);
@@ -86,7 +126,6 @@ static Lval_t* lval_create_void_type(void);
 static Lval_t* lval_create_user_defined_type(void);
 
 static void    lval_expr_print(Lval_t* v, char open, char close);
-static char*   ltype_name(LVAL_e t);
 static void    lval_print_str(Lval_t* v);
 static char*   freadline(FILE* fp, size_t size);
 
@@ -95,21 +134,11 @@ static void*     struct_from_list(Lval_t* vals, Lval_t* l_in_types);
 static void      ffi_call_extern(Lval_t* fn, CTypes_e* atypes, Lval_t** l_in_types, Lval_t* inputs, void* ret);
 
 /*
-    Keep a record of all builtin names that exist in the language,
+    Builtin names are flagged on their interned symbol,
     to prohibit the user from overriding any of them
 */
-static void _register_builtin_name(char* name);
 static bool _lookup_builtin_name(char* name);
 
-// TODO: Change to a hash-map, so that runtime lookup is faster
-//       (though this being a contiguous array, maybe lookup is faster
-//       this way as long as the number of builtins is small)
-static Builtins_record_t __builtins__ = {
-    .names = NULL,
-    .lengths = NULL,
-    .count = 0
-};
-
 /*
   Recursively constructs the list of values (lval)
   based on theirs tags which are defined in lang.h
@@ -139,20 +168,26 @@ Lval_t* lval_read(mpc_ast_t* ast) {
 }
 
 /*
-  Recursively deletes the list-value pointer as well as
-  any children that were allocated on the heap
+  Releases one reference to `v`, the last one recursively deletes the
+  list-value pointer as well as any children that were allocated on the heap
 */
 void lval_del(Lval_t* v) {
+    if (--v->refs > 0) return;
+
     switch (v->type) {
         case LVAL_FN: {
-            bool user_defined_fn = v->builtin == NULL;
+            bool user_defined_fn = v->func->builtin == NULL;
             if (user_defined_fn) {
-                lenv_del(v->env);
-                lval_del(v->formals);
-                lval_del(v->body);
-                free(v->cif);
-                free(v->atypes);
+                lenv_del(v->func->env);
+                lval_del(v->func->formals);
+                lval_del(v->func->body);
+                if (v->func->source != NULL) lval_del(v->func->source);
+                if (v->func->callees != NULL) lval_del(v->func->callees);
+                if (v->func->code != NULL) vm_chunk_del(v->func->code);
+                free(v->func->cif);
+                free(v->func->atypes);
             }
+            pool_free(&func_pool, v->func);
             break;
         }
 
@@ -165,24 +200,24 @@ void lval_del(Lval_t* v) {
 
         case LVAL_STR: free(v->str); break;
         case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
+        case LVAL_SYM: break;
 
         case LVAL_DLL: dlclose(v->dll); break;
 
-        case LVAL_USER_TYPE:
-        case LVAL_QEXPR:
-        case LVAL_SEXPR: {
-            for (int i = 0; i < v->count; ++i) {
-                lval_del(v->cell[i]);
-            }
-            free(v->cell);
+        case LVAL_USER_TYPE: {
+            lval_del(v->udt->fields);
+            pool_free(&udt_pool, v->udt);
             break;
         }
+
+        case LVAL_QEXPR:
+        case LVAL_SEXPR: lval_cells_release(v); break;
+
         default: 
             fprintf(stderr, "You added a new type, but forgot to add it to %s!\n", __func__);
             assert(false);
     }
-    free(v);
+    pool_free(&lval_pool, v);
 }
 
 void lval_print(Lval_t* v) {
@@ -194,20 +229,20 @@ void lval_print(Lval_t* v) {
         case LVAL_STR:        lval_print_str(v); break;
         case LVAL_SYM:        printf("%s", v->sym); break;
         case LVAL_SEXPR:      lval_expr_print(v, '(', ')'); break;
-        case LVAL_USER_TYPE:  lval_expr_print(v, '|', '|'); break;
+        case LVAL_USER_TYPE:  lval_expr_print(v->udt->fields, '|', '|'); break;
         case LVAL_QEXPR:      lval_expr_print(v, '{', '}'); break;
         case LVAL_EXIT:       printf("Exiting"); break;
         case LVAL_DLL:        printf("Dynamic library"); break;
         case LVAL_TYPE:       printf("%s", ctype_2_str(v->c_type)); break;
         case LVAL_OK:         break;
         case LVAL_FN: {
-            if (v->builtin != NULL) {
+            if (v->func->builtin != NULL) {
                 printf("<builtin>");
             } else {
                 printf("(\\ ");
-                lval_print(v->formals);
+                lval_formals_print(v->func);
                 putchar(' ');
-                lval_print(v->body);
+                lval_print(v->func->source != NULL ? v->func->source : v->func->body);
                 putchar(')');
             }
             break;
@@ -223,23 +258,45 @@ void lval_println(Lval_t* v) {
     lval_print(v); printf("\n");
 }
 
+/* the env `def` puts into, its bindings are found through the symbols themselves */
+static Lenv_t* global_env = NULL;
+
+/* bumped whenever a function inlined somewhere changes [see lval_inline_invalidate] */
+static int inline_epoch = 0;
+
 Lenv_t* lenv_new(void) {
-    Lenv_t* e = malloc(sizeof(Lenv_t));
+    Lenv_t* e = pool_alloc(&lenv_pool);
     e->parent = NULL;
+    e->n_locals = 0;
+    e->locals = NULL;
+    e->local_syms = NULL;
     e->count = 0;
+    e->capacity = 0;
     e->vals = NULL;
     e->syms = NULL;
     return e;
 }
 
+/*
+    Creates the one global env, its slots are indexed by `Lsym_t.global` (see lenv_put_move)
+*/
+Lenv_t* lenv_new_global(void) {
+    global_env = lenv_new();
+    return global_env;
+}
+
 void lenv_del(Lenv_t* e) {
-    for (int i = 0; i < e->count; ++i) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+    if (e == global_env) global_env = NULL;
+    for (int i = 0; i < e->n_locals; ++i) {
+        if (e->locals[i] != NULL) lval_del(e->locals[i]);
+    }
+    pool_cells_free((void**)e->locals, 2 * e->n_locals);
+    for (int i = 0; i < e->capacity; ++i) {
+        if (e->syms[i] != NULL) lval_del(e->vals[i]);
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    pool_cells_free((void**)e->syms, e->capacity);
+    pool_cells_free((void**)e->vals, e->capacity);
+    pool_free(&lenv_pool, e);
 }
 
 /*
@@ -251,6 +308,20 @@ void lenv_add_builtins(Lenv_t* e) {
     lenv_add_builtin(e, "tail",  builtin_tail);
     lenv_add_builtin(e, "eval",  builtin_eval);
     lenv_add_builtin(e, "join",  builtin_join);
+    lenv_add_builtin(e, "len",    builtin_len);
+    lenv_add_builtin(e, "nth",    builtin_nth);
+    lenv_add_builtin(e, "last",   builtin_last);
+    lenv_add_builtin(e, "take",   builtin_take);
+    lenv_add_builtin(e, "drop",   builtin_drop);
+    lenv_add_builtin(e, "in",     builtin_in);
+    lenv_add_builtin(e, "map",    builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl",  builtin_foldl);
+    lenv_add_builtin(e, "select", builtin_select);
+    lenv_add_builtin(e, "case",   builtin_case);
+    lenv_add_builtin(e, "while",    builtin_while);
+    lenv_add_builtin(e, "dotimes",  builtin_dotimes);
+    lenv_add_builtin(e, "for-each", builtin_for_each);
     lenv_add_builtin(e, "min",   builtin_min);
     lenv_add_builtin(e, "max",   builtin_max);
     lenv_add_builtin(e, "+",     builtin_add);
@@ -260,6 +331,7 @@ void lenv_add_builtins(Lenv_t* e) {
     lenv_add_builtin(e, "%",     builtin_mod);
     lenv_add_builtin(e, "^",     builtin_pow);
     lenv_add_builtin(e, "if",    builtin_if);
+    lenv_add_builtin(e, "let",   builtin_let);
     lenv_add_builtin(e, "==",    builtin_eq);
     lenv_add_builtin(e, "!=",    builtin_ne);
     lenv_add_builtin(e, ">",     builtin_gt);
@@ -306,24 +378,53 @@ void lenv_add_builtins(Lenv_t* e) {
     registers all symbols in an environment as builtin names
 */
 void _register_builtin_names_from_env(Lenv_t* e) {
-    for (int i = 0; i < e->count; ++i) {
-        _register_builtin_name(e->syms[i]);
+    for (int i = 0; i < e->capacity; ++i) {
+        if (e->syms[i] != NULL) sym_atom(e->syms[i])->flags |= SYM_BUILTIN;
     }
 }
 
-void _del_builtin_names(void) {
-    for (int i = 0; i < __builtins__.count; ++i) {
-        free(__builtins__.names[i]);
-    }
-    free(__builtins__.names);
-    free(__builtins__.lengths);
+/*
+  Evaluates `v` (a top-level form) by compiling it to bytecode and running it,
+  build with `-DTREE_WALKER` to evaluate everything with `lval_walk` instead
+*/
+Lval_t* lval_eval(Lenv_t* e, Lval_t* v) {
+    char here;
+    bool outermost = eval_stack_base == NULL;
+    if (outermost) eval_stack_base = &here;
+
+#ifdef TREE_WALKER
+    Lval_t* x = lval_walk(e, v);
+#else
+    Lval_t* x = v;
+    if (v->type == LVAL_SYM || v->type == LVAL_SEXPR) {
+        Lchunk_t* code = vm_compile(v);
+        x = vm_run(e, code);
+        vm_chunk_del(code);
+    }
+#endif
+
+    if (outermost) eval_stack_base = NULL;
+    return x;
+}
+
+/*
+    The points where evaluation recurses in C call this first, it returns an error once
+    more than EVAL_C_STACK bytes of the C stack were used since the outermost `lval_eval`
+    [measured between addresses of locals], NULL otherwise
+*/
+Lval_t* eval_stack_check(void) {
+    char here;
+    if (eval_stack_base == NULL) return NULL;
+    uintptr_t base = (uintptr_t)eval_stack_base, top = (uintptr_t)&here;
+    if ((base > top ? base - top : top - base) <= EVAL_C_STACK) return NULL;
+    return lval_create_err("Recursion is too deep, evaluation used up [%i] bytes of the C stack", EVAL_C_STACK);
 }
 
 /*
   Recursively creates the list of symbolic expressions by
-  calling `lval_eval_sexpr` which itself calls lval_eval
+  calling `lval_eval_sexpr` which itself calls lval_walk
 */
-Lval_t* lval_eval(Lenv_t* e, Lval_t* v) {
+static Lval_t* lval_walk(Lenv_t* e, Lval_t* v) {
     if (v->type == LVAL_SYM) {
         Lval_t* x = lenv_get(e, v);
         lval_del(v);
@@ -334,36 +435,138 @@ Lval_t* lval_eval(Lenv_t* e, Lval_t* v) {
 }
 
 Lval_t* lval_create_sexpr(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_SEXPR;
+    v->slice = false;
+    v->refs = 1;
     v->count = 0;
+    v->start = 0;
     v->cell = NULL;
     return v;
 }
 
 Lval_t* lval_create_qexpr(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_QEXPR;
+    v->slice = false;
+    v->refs = 1;
     v->count = 0;
+    v->start = 0;
     v->cell = NULL;
     return v;
 }
 
 Lval_t* lval_create_str(char* s) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_STR;
+    v->refs = 1;
     v->str = malloc(strlen(s) + 1);
     strcpy(v->str, s);
     return v;
 }
 
 Lval_t* lval_add(Lval_t* v, Lval_t* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(Lval_t*) * v->count);
-    v->cell[v->count - 1] = x;
+    lval_cells_reserve(v, v->count + 1);
+    v->cell[v->count++] = x;
     return v;
 }
 
+/*
+    A cell array is shared by the expressions viewing parts of it [see lval_slice], its first
+    slot counts them and the elements follow. The array owns every element that isn't NULL:
+    the slots outside of the elements of its expression are kept NULL until it's shared,
+    after which it's never written again, so the last expression letting go of it knows
+    what to release even if it only viewed a part of it
+*/
+#define CELLS_CAPACITY(v) ((1 << (v)->cap_log2) - 1)
+#define CELLS_BASE(v)     ((v)->cell - (v)->start)
+
+static intptr_t cells_refs(Lval_t* v) {
+    return (intptr_t)CELLS_BASE(v)[-1];
+}
+
+static void cells_set_refs(Lval_t* v, intptr_t refs) {
+    CELLS_BASE(v)[-1] = (Lval_t*)refs;
+}
+
+/*
+    Whether the caller is the only owner of `v`, which can then be mutated in place.
+    An expression must also be the only one viewing its cell array
+*/
+bool lval_is_unique(Lval_t* v) {
+    if (v->refs > 1) return false;
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) return true;
+    return !v->slice && (v->cell == NULL || cells_refs(v) == 1);
+}
+
+/*
+    Makes room for `n` elements in the cell array of the expression `v` [which must be unique].
+    The array only grows, geometrically, and the gap left in front of it by popping is reclaimed
+    once it's at least half of the array, so adding and popping elements are amortized O(1)
+*/
+void lval_cells_reserve(Lval_t* v, int n) {
+    assert((v->cell == NULL || cells_refs(v) == 1) && !v->slice && "Mutating a shared cell array");
+    int capacity = v->cell != NULL ? CELLS_CAPACITY(v) : 0;
+    if (v->start + n <= capacity) return;
+
+    Lval_t** base = CELLS_BASE(v);
+    if (n <= capacity && v->start >= capacity / 2) {
+        memmove(base, v->cell, sizeof(Lval_t*) * v->count);
+        memset(base + v->count, 0, sizeof(Lval_t*) * v->start);
+    } else {
+        int log2 = v->cell != NULL ? v->cap_log2 + 1 : 1;
+        while ((1 << log2) - 1 < n) log2++;
+        Lval_t** cells = (Lval_t**)pool_cells_alloc(1 << log2) + 1;
+        cells[-1] = (Lval_t*)1;
+        if (v->count) memcpy(cells, v->cell, sizeof(Lval_t*) * v->count);
+        memset(cells + v->count, 0, sizeof(Lval_t*) * ((1 << log2) - 1 - v->count));
+        if (v->cell != NULL) pool_cells_free((void**)(base - 1), 1 << v->cap_log2);
+        base = cells;
+        v->cap_log2 = log2;
+    }
+    v->cell = base;
+    v->start = 0;
+}
+
+/*
+    Frees the cell array of the unique expression `v` whose elements were moved out of it,
+    `v` is left empty
+*/
+void lval_cells_free(Lval_t* v) {
+    if (v->cell != NULL) {
+        assert(cells_refs(v) == 1 && "Freeing a shared cell array");
+        pool_cells_free((void**)(CELLS_BASE(v) - 1), 1 << v->cap_log2);
+    }
+    v->cell = NULL;
+    v->count = 0;
+    v->start = 0;
+}
+
+/*
+    Lets go of the cell array of the expression `v`, the last one
+    viewing it releases the elements the array owns and frees it
+*/
+static void lval_cells_release(Lval_t* v) {
+    if (v->cell == NULL) return;
+    intptr_t refs = cells_refs(v);
+    if (refs > 1) {
+        cells_set_refs(v, refs - 1);
+        return;
+    }
+
+    Lval_t** base = CELLS_BASE(v);
+    if (v->slice) {
+        for (int i = 0; i < CELLS_CAPACITY(v); ++i) {
+            if (base[i] != NULL) lval_del(base[i]);
+        }
+    } else {
+        for (int i = 0; i < v->count; ++i) {
+            lval_del(v->cell[i]);
+        }
+    }
+    pool_cells_free((void**)(base - 1), 1 << v->cap_log2);
+}
+
 Lval_t* builtin_load(Lenv_t* e, Lval_t* a) {
     LASSERT_NUM(__func__, a, 1);
     LASSERT_TYPE(__func__, a, 0, LVAL_STR);
@@ -381,7 +584,11 @@ Lval_t* builtin_load(Lenv_t* e, Lval_t* a) {
         mpc_ast_delete(r.output);
 
         while (expr->count) {
-            Lval_t* x = lval_eval(e, lval_pop(expr, 0));
+            Lval_t* x = lval_pop(expr, 0);
+#ifndef NO_FOLD
+            x = lval_fold(e, x);
+#endif
+            x = lval_eval(e, x);
             if (x->type == LVAL_ERR) lval_println(x);
             lval_del(x);
         }
@@ -401,9 +608,502 @@ Lval_t* builtin_load(Lenv_t* e, Lval_t* a) {
     }
 }
 
-static Lval_t* lval_eval_sexpr(Lenv_t* e, Lval_t* v) {
+/*
+    Load-time folding: the forms of a loaded file are partially evaluated before they run.
+    A call of an arithmetic/comparison builtin whose args are all literal numbers is replaced
+    by its result [the builtin names can never be rebound nor shadowed by a local].
+    Only S-Expressions and the Q-Expressions that builtins evaluate as code [bodies,
+    branches, clauses] are rewritten, any other Q-Expression is data and is left as is.
+    Build with `-DNO_FOLD` to load files as written.
+*/
+typedef enum {
+    FOLD_EXPR,    // evaluated as an expression
+    FOLD_BODY,    // a Q-Expression is evaluated as an S-Expression [e.g. the body of `fn`]
+    FOLD_CLAUSE,  // a Q-Expression is a `select`/`case` clause, both its elements are expressions
+} FOLD_e;
+
+static bool lval_is_literal(Lval_t* v) {
+    return v->type == LVAL_INTEGER || v->type == LVAL_DECIMAL || v->type == LVAL_BOOL;
+}
+
+/*
+    How the builtin named by `head` evaluates its arg `i` [the head itself is arg 0]
+*/
+static FOLD_e lval_fold_position(Lval_t* head, int i) {
+    if (head->type != LVAL_SYM) return FOLD_EXPR;
+    char* s = head->sym;
+    if (s == sym_intern("if"))                                         return i >= 2 ? FOLD_BODY : FOLD_EXPR;
+    if (s == sym_intern("eval") || s == sym_intern("let"))             return i == 1 ? FOLD_BODY : FOLD_EXPR;
+    if (s == sym_intern("fn") || s == sym_intern("\\"))                return i == 2 ? FOLD_BODY : FOLD_EXPR;
+    if (s == sym_intern("while"))                                      return i >= 1 ? FOLD_BODY : FOLD_EXPR;
+    if (s == sym_intern("dotimes") || s == sym_intern("for-each"))     return i == 3 ? FOLD_BODY : FOLD_EXPR;
+    if (s == sym_intern("select"))                                     return i >= 1 ? FOLD_CLAUSE : FOLD_EXPR;
+    if (s == sym_intern("case"))                                       return i >= 2 ? FOLD_CLAUSE : FOLD_EXPR;
+    return FOLD_EXPR;
+}
+
+/*
+    The builtin a call to `head` is folded with when all its args are literals, NULL if it's
+    not an arithmetic/comparison one
+*/
+static Lbuiltin_t lval_fold_builtin(Lval_t* head) {
+    static char* pure[] = {
+        "+", "-", "*", "/", "%", "^", "min", "max",
+        "==", "!=", ">", "<", ">=", "<=",
+    };
+    if (head->type != LVAL_SYM || global_env == NULL) return NULL;
+    for (size_t i = 0; i < sizeof(pure) / sizeof(pure[0]); ++i) {
+        if (head->sym != sym_intern(pure[i])) continue;
+        Lval_t* fn = lenv_lookup(global_env, head->sym);
+        return fn != NULL && fn->type == LVAL_FN ? fn->func->builtin : NULL;
+    }
+    return NULL;
+}
+
+/*
+    Folds the elements of the S-Expression [or Q-Expression evaluated as one] `v`, then `v` itself
+*/
+static Lval_t* lval_fold_sexpr(Lenv_t* e, Lval_t* v) {
+    v = lval_unshare(v);
+    for (int i = 0; i < v->count; ++i) {
+        Lval_t* x = v->cell[i];
+        FOLD_e pos = lval_fold_position(v->cell[0], i);
+        if (pos == FOLD_BODY && x->type == LVAL_QEXPR) {
+            x = lval_fold_sexpr(e, x);
+            if (x->type != LVAL_QEXPR) x = lval_add(lval_create_qexpr(), x);  // folded down to a value
+        } else if (pos == FOLD_CLAUSE && x->type == LVAL_QEXPR && x->count == 2) {
+            x = lval_unshare(x);
+            x->cell[0] = lval_fold(e, x->cell[0]);
+            x->cell[1] = lval_fold(e, x->cell[1]);
+        } else {
+            x = lval_fold(e, x);
+        }
+        v->cell[i] = x;
+    }
+
+    Lbuiltin_t builtin = v->count >= 2 ? lval_fold_builtin(v->cell[0]) : NULL;
+    if (builtin == NULL) return v;
+    for (int i = 1; i < v->count; ++i) {
+        if (!lval_is_literal(v->cell[i])) return v;
+    }
+
+    Lval_t* a = lval_create_sexpr();
+    for (int i = 1; i < v->count; ++i) {
+        lval_add(a, lval_ref(v->cell[i]));
+    }
+    Lval_t* x = builtin(e, a);
+    if (!lval_is_literal(x)) {  // e.g. a division by 0, it's left to fail when it runs
+        lval_del(x);
+        return v;
+    }
+    lval_del(v);
+    return x;
+}
+
+/*
+    Folds the expression `v` [see above], consumes `v` and gives back what it folded to
+*/
+static Lval_t* lval_fold(Lenv_t* e, Lval_t* v) {
+    return v->type == LVAL_SEXPR ? lval_fold_sexpr(e, v) : v;
+}
+
+/*
+    Inlining: when a function is defined with `fn`, the calls in its body to small non-recursive
+    user-defined functions [e.g. `st`, `not` or `comp` of the stdlib] are replaced by the callee's
+    body, with the args in place of its formals. The body as written is kept as the `source` of
+    the function and the names of the functions inlined into it as its `callees`, it's inlined
+    again from its source once one of those is redefined or bound as a local [see lval_inline_refresh].
+
+    Scoping is dynamic, so the callee's formals must not be looked up by name once they're gone:
+    - it calls builtins that run no user code, and the formals it calls are given plain builtins or
+      global functions that call only those and don't name its formals [`swap - a b`, `comp not len l`];
+    - when it evaluates data [`st` evaluates `head l`] or quotes a formal, each arg must be the
+      symbol of its formal [`st l`], so the data finds the same value bound to the same name.
+
+    An arg that's a call is only substituted when its formal is used once, unconditionally and
+    before any call of the callee's body returns, so it's evaluated as many times and in the same
+    order as before. Literals and symbols are only read, so their formals may be used freely.
+*/
+#define INLINE_MAX_ARGS 8
+
+typedef struct {
+    Lval_t* formals;
+    char* self;  // the name the callee is called by, it can't call itself
+    int size;  // symbols, values and lists of the body
+    int uses[INLINE_MAX_ARGS];
+    int order[INLINE_MAX_ARGS];  // rank of the first use of each formal, -1 while unused
+    bool lazy[INLINE_MAX_ARGS];  // used where it's not always evaluated [a branch, a clause, ...]
+    bool late[INLINE_MAX_ARGS];  // used after a call of the body returned
+    bool called[INLINE_MAX_ARGS];  // used as the head of a call
+    int n_used;
+    bool calls_done;
+    bool evals_data;  // evaluates a Q-Expression that isn't its own code, or quotes a formal
+    bool ok;
+} Linline_scan_t;
+
+static int lval_formal_index(Lval_t* formals, char* sym) {
+    for (int i = 0; i < formals->count; ++i) {
+        if (formals->cell[i]->sym == sym) return i;
+    }
+    return -1;
+}
+
+/*
+    The symbols that bind names, a body using them stays a call
+*/
+static bool lval_inline_binds(char* sym) {
+    static char* names[] = { "=", "def", "let", "while", "dotimes", "for-each", "read", "fn", "\\" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (sym == sym_intern(names[i])) return true;
+    }
+    return false;
+}
+
+static void lval_inline_scan_sym(Lval_t* v, Linline_scan_t* s, bool strict) {
+    int k = lval_formal_index(s->formals, v->sym);
+    if (k < 0) {
+        if (v->sym == s->self || lval_inline_binds(v->sym)) s->ok = false;
+        return;
+    }
+    s->uses[k]++;
+    if (!strict) s->lazy[k] = true;
+    if (s->calls_done) s->late[k] = true;
+    if (s->order[k] < 0) s->order[k] = s->n_used++;
+}
+
+/*
+    A Q-Expression the body doesn't evaluate itself
+*/
+static void lval_inline_scan_data(Lval_t* v, Linline_scan_t* s) {
+    s->size++;
+    if (v->type == LVAL_SYM) {
+        if (lval_formal_index(s->formals, v->sym) >= 0) s->evals_data = true;
+        lval_inline_scan_sym(v, s, false);
+    }
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) return;
+    for (int i = 0; i < v->count; ++i) {
+        lval_inline_scan_data(v->cell[i], s);
+    }
+}
+
+/*
+    Whether the callee may call `head`: a builtin that doesn't run user code [a function arg, a file],
+    which would see the names in scope when it's called, the callee's formals among them
+*/
+static bool lval_inline_calls_ok(Lval_t* head) {
+    static char* runs_code[] = { "map", "filter", "foldl", "load" };
+    if (head->type != LVAL_SYM) return false;
+    for (size_t i = 0; i < sizeof(runs_code) / sizeof(runs_code[0]); ++i) {
+        if (head->sym == sym_intern(runs_code[i])) return false;
+    }
+    Lval_t* fn = lenv_lookup(global_env, head->sym);
+    return fn != NULL && fn->type == LVAL_FN && fn->func->builtin != NULL;
+}
+
+static void lval_inline_scan_call(Lval_t* v, Linline_scan_t* s, bool strict);
+
+static void lval_inline_scan_expr(Lval_t* v, Linline_scan_t* s, bool strict) {
+    switch (v->type) {
+        case LVAL_SYM: s->size++; lval_inline_scan_sym(v, s, strict); break;
+        case LVAL_SEXPR: lval_inline_scan_call(v, s, strict); break;
+        case LVAL_QEXPR: lval_inline_scan_data(v, s); break;
+        default: s->size++; break;
+    }
+}
+
+/*
+    Scans a list that is evaluated as a call [the body, or an S-Expression of it]
+*/
+static void lval_inline_scan_call(Lval_t* v, Linline_scan_t* s, bool strict) {
+    s->size++;
+    Lval_t* head = v->count ? v->cell[0] : NULL;
+    if (v->count >= 2) {
+        int k = head->type == LVAL_SYM ? lval_formal_index(s->formals, head->sym) : -1;
+        if (k >= 0) s->called[k] = true;  // the arg decides [see lval_inline_head]
+        else if (!lval_inline_calls_ok(head)) s->ok = false;
+    }
+    for (int i = 0; i < v->count; ++i) {
+        Lval_t* x = v->cell[i];
+        FOLD_e pos = lval_fold_position(head, i);
+        if (pos == FOLD_BODY && x->type == LVAL_QEXPR) {  // only `eval` runs its body right away
+            lval_inline_scan_call(x, s, strict && head->sym == sym_intern("eval"));
+        } else if (pos == FOLD_CLAUSE && x->type == LVAL_QEXPR && x->count == 2) {
+            s->size++;
+            lval_inline_scan_expr(x->cell[0], s, false);
+            lval_inline_scan_expr(x->cell[1], s, false);
+        } else {
+            if (pos != FOLD_EXPR) s->evals_data = true;  // it may name the formals
+            bool lazy = i == 2 && head->type == LVAL_SYM
+                && (head->sym == sym_intern("&&") || head->sym == sym_intern("||"));
+            lval_inline_scan_expr(x, s, strict && !lazy);
+        }
+    }
+    s->calls_done = true;
+}
+
+/*
+    Scans the body of `fn` called by the name `name`, false if it's not a user-defined function
+    whose calls can be inlined at all
+*/
+static bool lval_inline_scan_fn(Lval_t* fn, char* name, Linline_scan_t* s) {
+    if (fn == NULL || fn->type != LVAL_FN) return false;
+    Lfunc_t* f = fn->func;
+    if (f->builtin != NULL || f->is_extern || f->n_bound != 0) return false;
+    if (f->formals->count > INLINE_MAX_ARGS) return false;
+    if (lval_formal_index(f->formals, sym_intern("&")) >= 0) return false;
+
+    *s = (Linline_scan_t){ .formals = f->formals, .self = name, .ok = true };
+    for (int i = 0; i < INLINE_MAX_ARGS; ++i) {
+        s->order[i] = -1;
+    }
+    lval_inline_scan_call(f->source != NULL ? f->source : f->body, s, true);
+    return s->ok;
+}
+
+/*
+    The user-defined function a call with the head `head` can be inlined from, NULL if there's none
+*/
+static Lval_t* lval_inline_callee(Lval_t* head, Linline_scan_t* s) {
+    if (head->type != LVAL_SYM || global_env == NULL) return NULL;
+    if (sym_atom(head->sym)->flags & SYM_LOCAL) return NULL;  // a local may shadow it
+    Lval_t* fn = lenv_lookup(global_env, head->sym);
+    return lval_inline_scan_fn(fn, head->sym, s) && s->size <= INLINE_MAX_SIZE ? fn : NULL;
+}
+
+/*
+    Whether `v` [the body of a function with the formals `own`] names one of the `formals`
+    of the callee that `args` doesn't give the symbol of the formal itself
+*/
+static bool lval_inline_names(Lval_t* v, Lval_t* own, Lval_t* formals, Lval_t** args) {
+    if (v->type == LVAL_SYM) {
+        int k = lval_formal_index(formals, v->sym);
+        return k >= 0 && lval_formal_index(own, v->sym) < 0
+            && !(args[k]->type == LVAL_SYM && args[k]->sym == v->sym);
+    }
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) return false;
+    for (int i = 0; i < v->count; ++i) {
+        if (lval_inline_names(v->cell[i], own, formals, args)) return true;
+    }
+    return false;
+}
+
+/*
+    Whether the arg `head` may be called in place of a formal of the callee `s`: a global
+    builtin that runs no code of its args [like `if`, `&&` or `map` would] and binds nothing,
+    or a global function that calls only builtins and doesn't name the callee's formals
+*/
+static bool lval_inline_head(Lval_t* head, Linline_scan_t* s, Lval_t** args) {
+    if (head->type != LVAL_SYM || (sym_atom(head->sym)->flags & SYM_LOCAL)) return false;
+    Lval_t* fn = lenv_lookup(global_env, head->sym);
+    if (fn == NULL || fn->type != LVAL_FN) return false;
+    if (fn->func->builtin != NULL) {
+        if (!lval_inline_calls_ok(head) || lval_inline_binds(head->sym)) return false;
+        if (head->sym == sym_intern("&&") || head->sym == sym_intern("||")) return false;
+        for (int i = 1; i <= 3; ++i) {
+            if (lval_fold_position(head, i) != FOLD_EXPR) return false;
+        }
+        return true;
+    }
+
+    Linline_scan_t g;
+    if (!lval_inline_scan_fn(fn, head->sym, &g) || g.evals_data) return false;
+    for (int k = 0; k < g.formals->count; ++k) {
+        if (g.called[k]) return false;
+    }
+    Lval_t* body = fn->func->source != NULL ? fn->func->source : fn->func->body;
+    return !lval_inline_names(body, g.formals, s->formals, args);
+}
+
+/*
+    Whether the args of the call `v` can take the place of the formals the callee uses as `s` says
+*/
+static bool lval_inline_args(Lval_t* v, Linline_scan_t* s) {
+    if (v->count - 1 != s->formals->count || v->count < 2) return false;
+    Lval_t** args = v->cell + 1;
+    int last = -1;
+    for (int k = 0; k < s->formals->count; ++k) {
+        bool same = args[k]->type == LVAL_SYM && args[k]->sym == s->formals->cell[k]->sym;
+        if (s->evals_data && !same) return false;
+        if (s->called[k] && !lval_inline_head(args[k], s, args)) return false;
+        if (args[k]->type != LVAL_SEXPR) continue;  // a literal or a symbol, it's only read
+        if (s->uses[k] != 1 || s->lazy[k] || s->late[k] || s->order[k] < last) return false;
+        last = s->order[k];
+    }
+    return true;
+}
+
+/*
+    `v` with the args in place of the formals, a new reference [`v` itself where none were]
+*/
+static Lval_t* lval_inline_subst(Lval_t* v, Lval_t* formals, Lval_t** args) {
+    if (v->type == LVAL_SYM) {
+        int k = lval_formal_index(formals, v->sym);
+        return lval_ref(k >= 0 ? args[k] : v);
+    }
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) return lval_ref(v);
+
+    Lval_t* x = lval_create_sexpr();
+    x->type = v->type;
+    lval_cells_reserve(x, v->count);
+    x->count = v->count;
+    bool changed = false;
     for (int i = 0; i < v->count; ++i) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+        x->cell[i] = lval_inline_subst(v->cell[i], formals, args);
+        changed |= x->cell[i] != v->cell[i];
+    }
+    if (changed) return x;
+    lval_del(x);
+    return lval_ref(v);
+}
+
+/*
+    Records that the function named `sym` was inlined into the function whose `callees` are given
+*/
+static void lval_inline_depend(Lval_t* callees, char* sym) {
+    sym_atom(sym)->flags |= SYM_INLINED;
+    for (int i = 0; i < callees->count; ++i) {
+        if (callees->cell[i]->sym == sym) return;
+    }
+    lval_add(callees, lval_create_sym(sym));
+}
+
+static Lval_t* lval_inline(Lval_t* v, int depth, Lval_t* callees);
+
+/*
+    Inlines the calls in the elements of `v`, a new reference [`v` itself when there were none],
+    the elements of a `clause` are plain expressions
+*/
+static Lval_t* lval_inline_elems(Lval_t* v, int depth, bool clause, Lval_t* callees) {
+    Lval_t* x = lval_create_sexpr();
+    x->type = v->type;
+    lval_cells_reserve(x, v->count);
+    x->count = v->count;
+    bool changed = false;
+    Lval_t* head = v->count ? v->cell[0] : NULL;
+    bool lambda = head != NULL && head->type == LVAL_SYM
+        && (head->sym == sym_intern("fn") || head->sym == sym_intern("\\"));
+    for (int i = 0; i < v->count; ++i) {
+        Lval_t* c = v->cell[i];
+        FOLD_e pos = clause ? FOLD_EXPR : lval_fold_position(head, i);
+        if (c->type == LVAL_SEXPR || (pos == FOLD_BODY && c->type == LVAL_QEXPR && !lambda)) {
+            x->cell[i] = lval_inline(c, depth, callees);
+        } else if (pos == FOLD_CLAUSE && c->type == LVAL_QEXPR && c->count == 2) {
+            x->cell[i] = lval_inline_elems(c, depth, true, callees);
+        } else {
+            x->cell[i] = lval_ref(c);
+        }
+        changed |= x->cell[i] != c;
+    }
+    if (changed) return x;
+    lval_del(x);
+    return lval_ref(v);
+}
+
+/*
+    Inlines the calls of the list `v` evaluated as a call [see above] and adds the names of the
+    functions inlined to `callees`, a new reference [`v` itself when nothing was inlined], the
+    bodies of lambdas defined in it are left to their own definition
+*/
+static Lval_t* lval_inline(Lval_t* v, int depth, Lval_t* callees) {
+    Lval_t* x = lval_inline_elems(v, depth, false, callees);
+    if (depth >= INLINE_MAX_DEPTH || x->count < 2) return x;
+
+    Linline_scan_t s;
+    Lval_t* fn = lval_inline_callee(x->cell[0], &s);
+    if (fn == NULL || !lval_inline_args(x, &s)) return x;
+
+    lval_inline_depend(callees, x->cell[0]->sym);
+    for (int k = 0; k < s.formals->count; ++k) {  // what a called formal was given matters as well
+        if (s.called[k] && !(sym_atom(x->cell[k + 1]->sym)->flags & SYM_BUILTIN)) {
+            lval_inline_depend(callees, x->cell[k + 1]->sym);
+        }
+    }
+    Lval_t* body = lval_inline_subst(fn->func->source != NULL ? fn->func->source : fn->func->body,
+                                     fn->func->formals, x->cell + 1);
+    body = lval_unshare(body);
+    body->type = x->type;
+    lval_del(x);
+
+    Lval_t* res = lval_inline(body, depth + 1, callees);
+    lval_del(body);
+    return res;
+}
+
+/*
+    (Re)inlines the calls in the body of the user-defined function `f` and compiles it
+*/
+static void lval_inline_func(Lfunc_t* f) {
+    Lval_t* source = f->source != NULL ? f->source : f->body;
+    Lval_t* callees = lval_create_qexpr();
+    Lval_t* body = lval_inline(source, 0, callees);
+    if (f->source != NULL) lval_del(f->body);
+    else f->source = f->body;
+    f->body = body;
+    if (f->callees != NULL) lval_del(f->callees);
+    f->callees = callees;
+    if (f->body == f->source) {  // nothing was inlined
+        lval_del(f->source);
+        f->source = NULL;
+        lval_del(f->callees);
+        f->callees = NULL;
+    }
+    f->epoch = inline_epoch;
+#ifndef TREE_WALKER
+    if (f->code != NULL) vm_chunk_del(f->code);
+    f->code = vm_compile_body(f->body, f->env);
+#endif
+}
+
+/*
+    The function named `sym` was inlined somewhere and got redefined, or bound as a local [which
+    a lookup may find first]: it's stamped, so that only the functions it was inlined into are
+    inlined again [see lval_inline_refresh]
+*/
+static void lval_inline_invalidate(char* sym) {
+    sym_atom(sym)->epoch = ++inline_epoch;
+}
+
+/*
+    Called before `f` runs: its calls are inlined again if one of its callees was stamped since
+    they were last checked, the others only take note of the new epoch
+*/
+void lval_inline_refresh(Lfunc_t* f) {
+    if (f->callees == NULL || f->epoch == inline_epoch) return;
+    for (int i = 0; i < f->callees->count; ++i) {
+        if (sym_atom(f->callees->cell[i]->sym)->epoch > f->epoch) {
+            lval_inline_func(f);
+            return;
+        }
+    }
+    f->epoch = inline_epoch;
+}
+
+static Lval_t* lval_eval_sexpr(Lenv_t* e, Lval_t* v) {
+    Lval_t* err = eval_stack_check();
+    if (err != NULL) {
+        lval_del(v);
+        return err;
+    }
+
+    if (v->count == 3 && v->cell[0]->type == LVAL_SYM
+        && (v->cell[0]->sym == sym_intern("&&") || v->cell[0]->sym == sym_intern("||"))) {
+        return lval_eval_logic(e, v);
+    }
+
+    if (!lval_is_unique(v)) {  // a template [e.g. a function body], it's only read and the results go in a fresh list
+        Lval_t* x = lval_create_sexpr();
+        lval_cells_reserve(x, v->count);
+        x->count = v->count;
+        for (int i = 0; i < v->count; ++i) {
+            x->cell[i] = lval_walk(e, lval_ref(v->cell[i]));
+        }
+        lval_del(v);
+        v = x;
+    } else {
+        v->type = LVAL_SEXPR;
+        for (int i = 0; i < v->count; ++i) {
+            v->cell[i] = lval_walk(e, v->cell[i]);
+        }
     }
 
     for (int i = 0; i < v->count; ++i) {
@@ -428,39 +1128,88 @@ static Lval_t* lval_eval_sexpr(Lenv_t* e, Lval_t* v) {
     return res;
 }
 
+/*
+    `&&` and `||` are special forms, the right operand is only evaluated
+    when the left one doesn't decide the result (see OP_LOGIC for the VM)
+*/
+static Lval_t* lval_eval_logic(Lenv_t* e, Lval_t* v) {
+    bool or = v->cell[0]->sym == sym_intern("||");
+    Lval_t* x = NULL;
+    for (int i = 1; i <= 2; ++i) {
+        Lval_t* y = lval_walk(e, lval_ref(v->cell[i]));
+        bool truth;
+        x = lval_logic_operand(y, or, i, &truth);
+        lval_del(y);
+        if (x != NULL) break;
+
+        x = lval_create_bool(truth);
+        if (truth == or) break;
+        if (i == 1) lval_del(x);
+    }
+    lval_del(v);
+    return x;
+}
+
+/*
+    Checks the `i`th operand `x` of `&&` [`||` if `or`], NULL if it's a number whose truth is
+    stored in `truth`, otherwise the error the operator gives instead [`x` when it's an error]
+*/
+Lval_t* lval_logic_operand(Lval_t* x, bool or, int i, bool* truth) {
+    switch (x->type) {
+        case LVAL_ERR: return lval_ref(x);
+        case LVAL_DECIMAL: *truth = !almost_eq(x->num.f, 0.0); return NULL;
+        case LVAL_BOOL:
+        case LVAL_INTEGER: *truth = x->num.li != 0; return NULL;
+        default:
+            return lval_create_err("Operator `%s` expects arguments of type Number,"
+                                   " but arg [%i] is of type [%s]",
+                                   or ? "||" : "&&", i, ltype_name(x->type));
+    }
+}
+
 static Lval_t* lval_create_lambda(Lval_t* formals, Lval_t* body) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_FN;
-    v->builtin = NULL;
-    v->env = lenv_new();
-    v->formals = formals;
-    v->body = body;
-    v->cif = malloc(sizeof(ffi_cif));
-    v->atypes = malloc(formals->count * sizeof(ffi_type*));
-    v->extern_ptr = NULL;
-    v->is_extern = false;
+    v->refs = 1;
+    v->func = pool_alloc(&func_pool);
+    v->func->builtin = NULL;
+    v->func->env = lenv_new();
+    v->func->formals = formals;
+    v->func->n_bound = 0;
+    v->func->body = body;
+    v->func->source = NULL;
+    v->func->callees = NULL;
+    v->func->epoch = 0;
+    v->func->code = NULL;
+    v->func->cif = NULL;
+    v->func->atypes = NULL;
+    v->func->extern_ptr = NULL;
+    v->func->is_extern = false;
     return v;
 }
 
 static Lval_t* lval_create_fn(Lbuiltin_t fn) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_FN;
-    v->is_extern = false;
-    v->builtin = fn;
+    v->refs = 1;
+    v->func = pool_alloc(&func_pool);
+    v->func->is_extern = false;
+    v->func->builtin = fn;
     return v;
 }
 
 static Lval_t* lval_create_sym(char* symbol) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_SYM;
-    v->sym = malloc(strlen(symbol) + 1);
-    strcpy(v->sym, symbol);
+    v->refs = 1;
+    v->sym = sym_intern(symbol);
     return v;
 }
 
-static Lval_t* lval_create_err(char* fmt, ...) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+Lval_t* lval_create_err(char* fmt, ...) {
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_ERR;
+    v->refs = 1;
 
     va_list va;
     va_start(va, fmt);
@@ -475,94 +1224,107 @@ static Lval_t* lval_create_err(char* fmt, ...) {
 }
 
 static Lval_t* lval_create_ok(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
-    v->type = LVAL_OK;
-    return v;
+    return lval_ref(&lval_ok);
 }
 
 static Lval_t* lval_create_void_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_VOID;
     return v;
 }
 
 static Lval_t* lval_create_int_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_INT;
     return v;
 }
 
 static Lval_t* lval_create_long_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_LONG;
     return v;
 }
 
 static Lval_t* lval_create_char_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_CHAR;
     return v;
 }
 
 static Lval_t* lval_create_float_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_FLOAT;
     return v;
 }
 
 static Lval_t* lval_create_double_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_DOUBLE;
     return v;
 }
 
 static Lval_t* lval_create_str_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_TYPE;
+    v->refs = 1;
     v->c_type = C_STRING;
     return v;
 }
 
 static Lval_t* lval_create_user_defined_type(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_USER_TYPE;
+    v->refs = 1;
     v->c_type = C_STRUCT;
-    v->count = 0;
-    v->ud_ffi_sz = 0;
-    v->ud_ffi_t = NULL;
-    v->cell = NULL;
+    v->udt = pool_alloc(&udt_pool);
+    v->udt->size = 0;
+    v->udt->ffi_t = NULL;
+    v->udt->fields = lval_create_qexpr();
     return v;
 }
 
 static Lval_t* lval_create_exit(void) {
-    Lval_t* v = malloc(sizeof(Lval_t));
-    v->type = LVAL_EXIT;
-    return v;
+    return lval_ref(&lval_exit);
 }
 
-static Lval_t* lval_create_bool(bool x) {
-    Lval_t* v = malloc(sizeof(Lval_t));
-    v->type = LVAL_BOOL;
-    v->num.li = x;
-    return v;
+Lval_t* lval_create_bool(bool x) {
+    return lval_ref(x ? &lval_true : &lval_false);
 }
 
-static Lval_t* lval_create_long(long x) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+Lval_t* lval_create_long(long x) {
+    if (x >= INT_CACHE_MIN && x <= INT_CACHE_MAX) {
+        Lval_t* v = &small_ints[x - INT_CACHE_MIN];
+        if (v->refs == 0) {  // first request for this integer
+            v->type = LVAL_INTEGER;
+            v->refs = LVAL_IMMORTAL;
+            v->num.li = x;
+        }
+        return lval_ref(v);
+    }
+
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_INTEGER;
+    v->refs = 1;
     v->num.li = x;
     return v;
 }
 
 static Lval_t* lval_create_double(double x) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_DECIMAL;
+    v->refs = 1;
     v->num.f = x;
     return v;
 }
@@ -600,16 +1362,16 @@ static Lval_t* lval_read_str(mpc_ast_t* ast) {
 // Ref: https://eli.thegreenplace.net/2013/03/04/flexible-runtime-interface-to-shared-libraries-with-libffi
 static void* struct_from_list(Lval_t* vals, Lval_t* l_in_type) {
 
-    void* data = malloc(l_in_type->ud_ffi_sz);
+    void* data = malloc(l_in_type->udt->size);
     if (data == NULL) {
-        fprintf(stderr, "Couldn't allocate %lu bytes. Buy more RAM!, %s", l_in_type->ud_ffi_sz, __func__);
+        fprintf(stderr, "Couldn't allocate %lu bytes. Buy more RAM!, %s", l_in_type->udt->size, __func__);
         exit(69);
     }
 
     size_t offset = 0;
     size_t sz = 0;
     for (int i = 0; i < vals->count; ++i) {
-        CTypes_e ctype = l_in_type->cell[i]->c_type;
+        CTypes_e ctype = l_in_type->udt->fields->cell[i]->c_type;
         sz = sizeof_ctype(ctype);
         switch (vals->cell[i]->type) {
             case LVAL_BOOL:
@@ -649,8 +1411,9 @@ static Lval_t* user_defined_to_list(void* data, Lval_t* l_out_type) {
     Lval_t* l = lval_create_qexpr();
     size_t offset = 0;
     size_t sz = 0;
-    for (int i = 0; i < l_out_type->count; i++) {
-        CTypes_e ctype = l_out_type->cell[i]->c_type;
+    Lval_t* fields = l_out_type->udt->fields;
+    for (int i = 0; i < fields->count; i++) {
+        CTypes_e ctype = fields->cell[i]->c_type;
         sz = sizeof_ctype(ctype);
         Lval_t* val = NULL;
         switch (ctype) {
@@ -752,7 +1515,6 @@ static void ffi_call_extern(Lval_t* fn, CTypes_e* atypes, Lval_t** l_in_types, L
     void *avalues[inputs->count];
     int int_convesion_buf[inputs->count];
     float float_convesion_buf[inputs->count];
-    int to_free = -1;
     for (int i = 0; i < inputs->count; i++) {
         switch (atypes[i]) {
             case C_VOID: {
@@ -783,7 +1545,6 @@ static void ffi_call_extern(Lval_t* fn, CTypes_e* atypes, Lval_t** l_in_types, L
             }
             case C_STRUCT: {
                 avalues[i] = struct_from_list(inputs->cell[i], l_in_types[i]);
-                to_free = i;
                 break;
             }
             default:
@@ -792,14 +1553,16 @@ static void ffi_call_extern(Lval_t* fn, CTypes_e* atypes, Lval_t** l_in_types, L
         }
     }
 
-    ffi_call(fn->cif, FFI_FN(fn->extern_ptr), ret, avalues);
-    if (to_free != -1) free(avalues[to_free]);
-    lval_del(inputs);
+    ffi_call(fn->func->cif, FFI_FN(fn->func->extern_ptr), ret, avalues);
+    for (int i = 0; i < inputs->count; i++) {
+        if (atypes[i] == C_STRUCT) free(avalues[i]);
+    }
+    lval_del(inputs);
 }
 
 static Lval_t* lval_call_extern(Lenv_t* e, Lval_t* fn, Lval_t* inputs) {
     int n_given = inputs->count;
-    int n_expct = fn->formals->count;
+    int n_expct = fn->func->formals->count;
 
     if (n_given != n_expct) {
         lval_del(inputs);
@@ -809,121 +1572,177 @@ static Lval_t* lval_call_extern(Lenv_t* e, Lval_t* fn, Lval_t* inputs) {
     CTypes_e atypes[n_given];
     Lval_t* l_in_types[n_given];
     for (int i = 0; i < n_given; ++i) {
-        l_in_types[i] = lenv_get(e, fn->formals->cell[i]);
+        l_in_types[i] = lenv_get(e, fn->func->formals->cell[i]);
         bool ret = lval_type_2_ctype(inputs->cell[i], &atypes[i], l_in_types[i]->c_type);
         bool okay = ret && l_in_types[i]->c_type == atypes[i];
-        LASSERT(inputs, okay, "Extern func `%s` got input arg [%i] of type [%s], expected [%s]",
-                              __func__, i + 1, ctype_2_str(atypes[i]), ctype_2_str(l_in_types[i]->c_type));
+        if (!okay) {
+            Lval_t* err = lval_create_err("Extern func `%s` got input arg [%i] of type [%s], expected [%s]",
+                                          __func__, i + 1, ctype_2_str(atypes[i]), ctype_2_str(l_in_types[i]->c_type));
+            for (int j = 0; j <= i; ++j) {
+                lval_del(l_in_types[j]);
+            }
+            lval_del(inputs);
+            return err;
+        }
     }
 
-    Lval_t* out = lenv_get(e, fn->body->cell[0]);
+    Lval_t* out = lenv_get(e, fn->func->body->cell[0]);
+    Lval_t* res = NULL;
 
     switch (out->c_type) {
         case C_VOID: {
             ffi_call_extern(fn, atypes, l_in_types, inputs, NULL);
-            return lval_create_ok();
+            res = lval_create_ok();
+            break;
         }
         case C_INT: {
             int ret = 0;
             ffi_call_extern(fn, atypes, l_in_types, inputs, &ret);
-            return lval_create_long(ret);
+            res = lval_create_long(ret);
+            break;
         }
         case C_LONG: {
             long ret = 0;
             ffi_call_extern(fn, atypes, l_in_types, inputs, &ret);
-            return lval_create_long(ret);
+            res = lval_create_long(ret);
+            break;
         }
         case C_FLOAT: {
             float ret = 0.0;
             ffi_call_extern(fn, atypes, l_in_types, inputs, &ret);
-            return lval_create_double(ret);
+            res = lval_create_double(ret);
+            break;
         }
         case C_DOUBLE: {
             double ret = 0.0;
             ffi_call_extern(fn, atypes, l_in_types, inputs, &ret);
-            return lval_create_double(ret);
+            res = lval_create_double(ret);
+            break;
         }
         case C_STRING: {
             char *ret = NULL;
             ffi_call_extern(fn, atypes, l_in_types, inputs, &ret);
-            return lval_create_str(ret);
+            res = lval_create_str(ret);
+            break;
         }
         case C_STRUCT: {
-            void *ret = malloc(out->ud_ffi_sz);
+            void *ret = malloc(out->udt->size);
             ffi_call_extern(fn, atypes, l_in_types, inputs, ret);
-            return user_defined_to_list(ret, out);
+            res = user_defined_to_list(ret, out);
+            break;
         }
         default:
             fprintf(stderr, "You added a new C-type, but forgot to add it to %s!\n", __func__);
             assert(false);
     }
 
-    return lval_create_err("UNREACHABLE");
+    for (int i = 0; i < n_given; ++i) {
+        lval_del(l_in_types[i]);
+    }
+    lval_del(out);
+    return res;
 }
 
 /*
     Dispatches function calls based on whether it's a builtin, externally linked one, or user-defined
 */
-static Lval_t* lval_call(Lenv_t* e, Lval_t* fn, Lval_t* a) {
-    if (fn->builtin != NULL) return fn->builtin(e, a);
-    if (fn->is_extern) return lval_call_extern(e, fn, a);
+Lval_t* lval_call(Lenv_t* e, Lval_t* fn, Lval_t* a) {
+    if (fn->func->builtin != NULL) return fn->func->builtin(e, a);
+    if (fn->func->is_extern) return lval_call_extern(e, fn, a);
+
+    /* binding mutates the function, it's done in place only if the caller is its only owner */
+    lval_inline_refresh(fn->func);
+    fn = fn->refs == 1 ? lval_ref(fn) : lval_copy(fn);
 
+    Lval_t* err = lval_bind(e, fn, a);
+    if (err != NULL) {
+        lval_del(fn);
+        return err;
+    }
+
+    if (fn->func->n_bound == fn->func->formals->count) { // all formals were bound -> evaluate function
+        fn->func->env->parent = e;
+        Lval_t* x = fn->func->code != NULL
+            ? vm_run(fn->func->env, fn->func->code)
+            : lval_eval_sexpr(fn->func->env, lval_ref(fn->func->body));
+        lval_del(fn);
+        return x;
+    } else { // return partially evaluated function
+        return fn;
+    }
+}
+
+/*
+    Binds the args `a` to the next unbound formals of the user-defined `fn` (into the locals
+    of its env), consumes `a` and returns an error if they don't match, NULL otherwise
+*/
+Lval_t* lval_bind(Lenv_t* e, Lval_t* fn, Lval_t* a) {
+    Lfunc_t* f = fn->func;
+    Lval_t** formals = f->formals->cell;
+    int n_formals = f->formals->count;
     int n_given = a->count;
     while (a->count) {
-        if (fn->formals->count == 0) {
+        if (f->n_bound == n_formals) {
             lval_del(a);
             return lval_create_err(
                 // TODO: figure out how to provide the name of the function
-                "Function `user-defined` expects [%i] args, got [%i].", fn->formals->count, n_given);
+                "Function `user-defined` expects [%i] args, got [%i].", n_formals - f->n_bound, n_given);
         }
 
-        Lval_t* sym = lval_pop(fn->formals, 0);
+        Lval_t* sym = formals[f->n_bound++];
 
         /* Special case where we have a variable number of arguments, syntax `sym & syms` */
         if (strncmp(sym->sym, "&", 2) == 0) {
-            if (fn->formals->count != 1) {
+            if (f->n_bound != n_formals - 1) {
                 lval_del(a);
                 return lval_create_err("Invalid format; "
                     "symbol `&` must be followed by a single symbol");
             }
-            Lval_t* sym_list = lval_pop(fn->formals, 0);
-            lenv_put(fn->env, sym_list, builtin_list(e, a));
-            lval_del(sym);
-            lval_del(sym_list);
-            break;
+            Lval_t* sym_list = formals[f->n_bound++];
+            lenv_put_move(f->env, sym_list, builtin_list(e, a));  // the rest of the args are the list
+            return NULL;
         }
 
-        Lval_t* val = lval_pop(a, 0);
-        lenv_put(fn->env, sym, val);  // register into the func "local" environment
-        lval_del(sym);
-        lval_del(val);
+        lenv_put_move(f->env, sym, lval_pop(a, 0));  // register into the func "local" environment
     }
 
     lval_del(a);
 
     /*
         Done with user input (only supplied named args, no va_args), but fn formals
-        still have the `&` in them -> change to empty list
+        still have the `&` in them -> bind the va_args symbol to an empty list
     */
-    if (fn->formals->count > 0 && strncmp(fn->formals->cell[0]->sym, "&", 2) == 0) {
-        if (fn->formals->count != 2) {
+    if (f->n_bound < n_formals && strncmp(formals[f->n_bound]->sym, "&", 2) == 0) {
+        if (n_formals - f->n_bound != 2) {
             return lval_create_err("Invalid format; symbol `&` must "
                                     "be followed by a single symbol");
         }
-        lval_del(lval_pop(fn->formals, 0));  // pop and delete the `&` symbol
-        Lval_t* sym = lval_pop(fn->formals, 0);  // va_args symbol
-        Lval_t* val = lval_create_qexpr();  // empty list
-        lenv_put(fn->env, sym, val);  // register these into the "local" env
-        lval_del(sym);
-        lval_del(val);
+        Lval_t* sym = formals[f->n_bound + 1];  // va_args symbol
+        lenv_put_move(f->env, sym, lval_create_qexpr());  // empty list into the "local" env
+        f->n_bound = n_formals;
     }
 
-    if (fn->formals->count == 0) { // all formals were bound -> evaluate function
-        fn->env->parent = e;
-        return builtin_eval(fn->env, lval_add(lval_create_sexpr(), lval_copy(fn->body)));
-    } else { // return partially evaluated function
-        return lval_copy(fn);
+    return NULL;
+}
+
+/*
+    Prints the formals of a user-defined function that are still unbound
+*/
+static void lval_formals_print(Lfunc_t* f) {
+    putchar('{');
+    for (int i = f->n_bound; i < f->formals->count; ++i) {
+        lval_print(f->formals->cell[i]);
+        if (i != (f->formals->count - 1)) { putchar(' '); }
     }
+    putchar('}');
+}
+
+static bool lval_formals_eq(Lfunc_t* x, Lfunc_t* y) {
+    if (x->formals->count - x->n_bound != y->formals->count - y->n_bound) return false;
+    for (int i = 0; i < x->formals->count - x->n_bound; ++i) {
+        if (!lval_eq(x->formals->cell[x->n_bound + i], y->formals->cell[y->n_bound + i])) return false;
+    }
+    return true;
 }
 
 static void lval_expr_print(Lval_t* v, char open, char close) {
@@ -938,113 +1757,114 @@ static void lval_expr_print(Lval_t* v, char open, char close) {
 static Lval_t* lval_pop(Lval_t* v, int i) {
     assert(i < v->count && "Index provided to `pop` is out of bound");
     Lval_t* x = v->cell[i];
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(Lval_t*) * (v->count - i - 1));
+    if (i < v->count / 2) {  // closer to the front, which moves up (see lval_cells_reserve)
+        memmove(&v->cell[1], &v->cell[0], sizeof(Lval_t*) * i);
+        v->cell[0] = NULL;
+        v->cell++;
+        v->start++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i+1], sizeof(Lval_t*) * (v->count - i - 1));
+        v->cell[v->count - 1] = NULL;
+    }
     v->count--;
-    v->cell = realloc(v->cell, sizeof(Lval_t*) * v->count);
     return x;
 }
 
-static Lval_t* lval_take(Lval_t* v, int i) {
-    Lval_t* x = lval_pop(v, i);
+/*
+    The `n` elements of the expression `v` from the `i`th on, consumes `v`. A unique `v` drops
+    the other elements, otherwise the result is a view sharing the cell array of `v`, made in
+    O(1) whatever the length, so walking a list with `tail` is linear rather than quadratic
+*/
+static Lval_t* lval_slice(Lval_t* v, int i, int n) {
+    assert(i >= 0 && n >= 0 && i + n <= v->count && "Slice out of bound");
+    if (lval_is_unique(v)) {
+        while (v->count > i + n) lval_del(lval_pop(v, v->count - 1));
+        while (v->count > n) lval_del(lval_pop(v, 0));
+        return v;
+    }
+
+    Lval_t* x = v->type == LVAL_QEXPR ? lval_create_qexpr() : lval_create_sexpr();
+    if (n != 0) {
+        cells_set_refs(v, cells_refs(v) + 1);
+        x->slice = true;
+        x->cap_log2 = v->cap_log2;
+        x->cell = v->cell + i;
+        x->start = v->start + i;
+        x->count = n;
+    }
     lval_del(v);
     return x;
 }
 
-static Lval_t* builtin_add(Lenv_t* e, Lval_t* a) { return builtin_op(e, a, "+"); }
-static Lval_t* builtin_sub(Lenv_t* e, Lval_t* a) { return builtin_op(e, a, "-"); }
-static Lval_t* builtin_mul(Lenv_t* e, Lval_t* a) { return builtin_op(e, a, "*"); }
-static Lval_t* builtin_div(Lenv_t* e, Lval_t* a) { return builtin_op(e, a, "/"); }
-static Lval_t* builtin_mod(Lenv_t* e, Lval_t* a) { return builtin_op(e, a, "%"); }
-static Lval_t* builtin_pow(Lenv_t* e, Lval_t* a) { return builtin_op(e, a, "^"); }
-
-static Lval_t* builtin_op(Lenv_t* e, Lval_t* a, char* op) {
-    (void)e;
-    for (int i = 0; i < a->count; ++i) {
-        if (!IS_NUM(a, i)) {
-            char* type = ltype_name(a->cell[i]->type);
-            lval_del(a);
-            return lval_create_err("Operator `%s` cannot operate on non-numbers; "
-                                   "Arg [%i] is of type [%s]", op, i + 1, type);
-        }
-    }
-
-    Lval_t* x = lval_pop(a, 0);
-    if (x->type == LVAL_BOOL) x->type = LVAL_INTEGER;
-
-    // no arguments provided and `op` is `-` then perform negation
-    if ((strncmp(op, "-", 2) == 0) && a->count == 0) {
-        if (x->type == LVAL_INTEGER) x->num.li = -x->num.li;
-        else if (x->type == LVAL_DECIMAL) x->num.f = -x->num.f;
-    }
-
-    while (a->count > 0) {
-        Lval_t* y = lval_pop(a, 0);
-        if (y->type == LVAL_BOOL) y->type = LVAL_INTEGER;
-
-        // if any one of inuts is a decimal, output will be decimal
-        if (x->type == LVAL_DECIMAL || y->type == LVAL_DECIMAL) {
-            if (y->type != LVAL_DECIMAL) {
-                y->type = LVAL_DECIMAL; 
-                y->num.f = (double)y->num.li;
-            } else if (x->type != LVAL_DECIMAL) {
-                x->type = LVAL_DECIMAL;
-                x->num.f = (double)x->num.li;
-            }
-
-            if      (strncmp(op, "+", 2) == 0) x->num.f += y->num.f;
-            else if (strncmp(op, "-", 2) == 0) x->num.f -= y->num.f;
-            else if (strncmp(op, "*", 2) == 0) x->num.f *= y->num.f;
-            else if (strncmp(op, "^", 2) == 0) x->num.f = pow(x->num.f, y->num.f);
-            else if (strncmp(op, "%", 2) == 0) {
-                if (almost_eq(y->num.f, 0.0)) {
-                    lval_del(x);
-                    lval_del(y);
-                    x = lval_create_err("Right-hand operand of '%s' cannot be 0!", op);
-                    break;
-                }
-                x->num.f = fmod(x->num.f, y->num.f);
-            }
-            else if (strncmp(op, "/", 2) == 0) {
-                if (almost_eq(y->num.f, 0.0)) {
-                    lval_del(x);
-                    lval_del(y);
-                    x = lval_create_err("Division By Zero!");
-                    break;
-                }
-                x->num.f /= y->num.f;
-            }
-        } else {
-            if      (strncmp(op, "+", 2) == 0) x->num.li += y->num.li;
-            else if (strncmp(op, "-", 2) == 0) x->num.li -= y->num.li;
-            else if (strncmp(op, "*", 2) == 0) x->num.li *= y->num.li;
-            else if (strncmp(op, "^", 2) == 0) x->num.li = (long)pow(x->num.li, y->num.li);
-            else if (strncmp(op, "%", 2) == 0) {
-                if (y->num.li == 0) {
-                    lval_del(x);
-                    lval_del(y);
-                    x = lval_create_err("Right-hand operand of '%s' cannot be 0!", op);
-                    break;
-                }
-                x->num.li %= y->num.li;
-            }
-            else if (strncmp(op, "/", 2) == 0) {
-                if (y->num.li == 0) {
-                    lval_del(x);
-                    lval_del(y);
-                    x = lval_create_err("Division By Zero!");
-                    break;
-                }
-                x->num.li /= y->num.li;
-            }
-        }
-
-        lval_del(y);
-    }
-
-    lval_del(a);
+static Lval_t* lval_take(Lval_t* v, int i) {
+    Lval_t* x = lval_pop(v, i);
+    lval_del(v);
     return x;
 }
 
+/*
+    The arithmetic builtins are generated, one per operator, from a kernel per operand type:
+    `x` accumulates the result [unboxed, a long until the first decimal operand], `y` is the
+    next operand, `unary` is the result of a single operand and `check` is run on `y` before
+    the kernel. The operands are read in place, never mutated.
+*/
+#define ARITH_DEFINE(name, op, unary, int_kernel, dec_kernel, int_check, dec_check)              \
+static Lval_t* builtin_##name(Lenv_t* e, Lval_t* a) {                                           \
+    (void)e;                                                                                    \
+    LASSERT(a, a->count >= 1, "Operator `%s` expects at least 1 argument, got [%i]",            \
+            op, a->count);                                                                      \
+    for (int i = 0; i < a->count; ++i) {                                                        \
+        LASSERT(a, IS_NUM(a, i), "Operator `%s` cannot operate on non-numbers; "                \
+                "Arg [%i] is of type [%s]", op, i + 1, ltype_name(a->cell[i]->type));           \
+    }                                                                                           \
+                                                                                                \
+    int i = 1;                                                                                  \
+    double acc = a->cell[0]->num.f;                                                             \
+    if (a->cell[0]->type != LVAL_DECIMAL) {                                                     \
+        long x = a->cell[0]->num.li;                                                            \
+        if (a->count == 1) x = unary;                                                           \
+        for (; i < a->count && a->cell[i]->type != LVAL_DECIMAL; ++i) {                         \
+            long y = a->cell[i]->num.li;                                                        \
+            int_check;                                                                          \
+            x = int_kernel;                                                                     \
+        }                                                                                       \
+        if (i == a->count) {                                                                    \
+            lval_del(a);                                                                        \
+            return lval_create_long(x);                                                         \
+        }                                                                                       \
+        acc = (double)x;                                                                        \
+    } else if (a->count == 1) {                                                                 \
+        double x = acc;                                                                         \
+        acc = unary;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    for (; i < a->count; ++i) {                                                                 \
+        double x = acc;                                                                         \
+        double y = a->cell[i]->type == LVAL_DECIMAL ? a->cell[i]->num.f : (double)a->cell[i]->num.li; \
+        dec_check;                                                                              \
+        acc = dec_kernel;                                                                       \
+    }                                                                                           \
+    lval_del(a);                                                                                \
+    return lval_create_double(acc);                                                             \
+}
+
+/* an operator that never fails on an operand */
+#define ARITH_BUILTIN(name, op, unary, int_kernel, dec_kernel)                                   \
+    ARITH_DEFINE(name, op, unary, int_kernel, dec_kernel, (void)0, (void)0)
+
+/* an operator whose operand `y` must satisfy `ok` (e.g. a divisor that isn't 0) */
+#define ARITH_BUILTIN_CHECKED(name, op, unary, int_kernel, dec_kernel, int_ok, dec_ok, err)     \
+    ARITH_DEFINE(name, op, unary, int_kernel, dec_kernel,                                       \
+                 LASSERT(a, int_ok, err, op), LASSERT(a, dec_ok, err, op))
+
+ARITH_BUILTIN(add, "+", x,  x + y, x + y)
+ARITH_BUILTIN(sub, "-", -x, x - y, x - y)
+ARITH_BUILTIN(mul, "*", x,  x * y, x * y)
+ARITH_BUILTIN(pow, "^", x,  (long)pow(x, y), pow(x, y))
+ARITH_BUILTIN_CHECKED(div, "/", x,  x / y, x / y, y != 0, !almost_eq(y, 0.0), "Division By Zero!")
+ARITH_BUILTIN_CHECKED(mod, "%", x,  x % y, fmod(x, y), y != 0, !almost_eq(y, 0.0),
+                      "Right-hand operand of '%s' cannot be 0!")
+
 static Lval_t* builtin_min(Lenv_t* e, Lval_t* a) {
     (void)e;
     LASSERT(a, a->count >= 2, "Function `%s` expects at least 2 arguments, got [%i]", __func__, a->count);
@@ -1054,26 +1874,28 @@ static Lval_t* builtin_min(Lenv_t* e, Lval_t* a) {
                                  i + 1, ltype_name(a->cell[i]->type));
     }
 
-    Lval_t* x = lval_pop(a, 0);
-    for (int i = 0; i < a->count; ++i) {
-        Lval_t* y = a->cell[i];
-
-        if (x->type == LVAL_DECIMAL || y->type == LVAL_DECIMAL) {
-            if (y->type != LVAL_DECIMAL) {
-                y->type = LVAL_DECIMAL;
-                y->num.f = (double)y->num.li;
-            } else if (x->type != LVAL_DECIMAL) {
-                x->type = LVAL_DECIMAL;
-                x->num.f = (double)x->num.li;
+    bool decimal = a->cell[0]->type == LVAL_DECIMAL;
+    Numeric_u x = a->cell[0]->num;
+    for (int i = 1; i < a->count; ++i) {
+        Numeric_u y = a->cell[i]->num;
+
+        if (decimal || a->cell[i]->type == LVAL_DECIMAL) {
+            if (a->cell[i]->type != LVAL_DECIMAL) {
+                y.f = (double)y.li;
+            } else if (!decimal) {
+                decimal = true;
+                x.f = (double)x.li;
             }
-            x->num.f = fmin(x->num.f, y->num.f);  
+            x.f = fmin(x.f, y.f);
         } else {
-            x->num.li = min(x->num.li, y->num.li);  
+            x.li = min(x.li, y.li);
         }
     }
 
+    LVAL_e type = a->cell[0]->type;
     lval_del(a);
-    return x;
+    if (decimal) return lval_create_double(x.f);
+    return type == LVAL_BOOL ? lval_create_bool(x.li) : lval_create_long(x.li);
 }
 
 static Lval_t* builtin_max(Lenv_t* e, Lval_t* a) {
@@ -1085,88 +1907,75 @@ static Lval_t* builtin_max(Lenv_t* e, Lval_t* a) {
                                  i + 1, ltype_name(a->cell[i]->type));
     }
 
-    Lval_t* x = lval_pop(a, 0);
-    for (int i = 0; i < a->count; ++i) {
-        Lval_t* y = a->cell[i];
+    bool decimal = a->cell[0]->type == LVAL_DECIMAL;
+    Numeric_u x = a->cell[0]->num;
+    for (int i = 1; i < a->count; ++i) {
+        Numeric_u y = a->cell[i]->num;
 
-        if (x->type == LVAL_DECIMAL || y->type == LVAL_DECIMAL) {
-            if (x->type == LVAL_DECIMAL && y->type != LVAL_DECIMAL) {
-                y->type = LVAL_DECIMAL; y->num.f = (double)y->num.li;
-            } else if (x->type != LVAL_DECIMAL && y->type == LVAL_DECIMAL) {
-                x->type = LVAL_DECIMAL; x->num.f = (double)x->num.li;
+        if (decimal || a->cell[i]->type == LVAL_DECIMAL) {
+            if (a->cell[i]->type != LVAL_DECIMAL) {
+                y.f = (double)y.li;
+            } else if (!decimal) {
+                decimal = true;
+                x.f = (double)x.li;
             }
-            x->num.f = fmax(x->num.f, y->num.f);  
+            x.f = fmax(x.f, y.f);
         } else {
-            x->num.li = max(x->num.li, y->num.li);  
+            x.li = max(x.li, y.li);
         }
     }
 
+    LVAL_e type = a->cell[0]->type;
     lval_del(a);
-    return x;
+    if (decimal) return lval_create_double(x.f);
+    return type == LVAL_BOOL ? lval_create_bool(x.li) : lval_create_long(x.li);
 }
 
-static Lval_t* builtin_gt(Lenv_t* e, Lval_t* a)  { return builtin_ord(e, a, ">"); }
-static Lval_t* builtin_lt(Lenv_t* e, Lval_t* a)  { return builtin_ord(e, a, "<"); }
-static Lval_t* builtin_ge(Lenv_t* e, Lval_t* a)  { return builtin_ord(e, a, ">="); }
-static Lval_t* builtin_le(Lenv_t* e, Lval_t* a)  { return builtin_ord(e, a, "<="); }
-static Lval_t* builtin_and(Lenv_t* e, Lval_t* a) { return builtin_ord(e, a, "&&"); }
-static Lval_t* builtin_or(Lenv_t* e, Lval_t* a)  { return builtin_ord(e, a, "||"); }
-
-static Lval_t* builtin_ord(Lenv_t* e, Lval_t* a, char* op) {
-    (void)e;
-    LASSERT(a, a->count == 2, "Operator `%s` expects 2 arguments, got [%i]", op, a->count);
-
-    Lval_t* x = a->cell[0];
-    LASSERT(a, IS_NUM(a, 0), "Operator `%s` expects arguments of type Number,"
-                             " but arg [%i] is of type [%s]",
-                             op, 1, ltype_name(x->type));
-
-    Lval_t* y = a->cell[1];
-    LASSERT(a, IS_NUM(a, 1), "Operator `%s` expects arguments of type Number,"
-                             " but arg [%i] is of type [%s]",
-                             op, 2, ltype_name(y->type));
-
-    Lval_t* res = lval_create_bool(false);
-    if (x->type == LVAL_DECIMAL || y->type == LVAL_DECIMAL) {
-        if (y->type != LVAL_DECIMAL) {
-            y->type = LVAL_DECIMAL;
-            y->num.f = (double)y->num.li;
-        } else if (x->type != LVAL_DECIMAL) {
-            x->type = LVAL_DECIMAL;
-            x->num.f = (double)x->num.li;
-        }
-        if (strncmp(op, ">", 2) == 0)       res->num.li = x->num.f > y->num.f;
-        else if (strncmp(op, "<", 2) == 0)  res->num.li = x->num.f < y->num.f;
-        else if (strncmp(op, ">=", 3) == 0) res->num.li = x->num.f >= y->num.f;
-        else if (strncmp(op, "<=", 3) == 0) res->num.li = x->num.f <= y->num.f;
-        else if (strncmp(op, "&&", 3) == 0) res->num.li = !almost_eq(x->num.f, 0.0) && !almost_eq(y->num.f, 0.0);
-        else if (strncmp(op, "||", 3) == 0) res->num.li = !almost_eq(x->num.f, 0.0) || !almost_eq(y->num.f, 0.0);
-    } else {
-        if (strncmp(op, ">", 2) == 0)       res->num.li = x->num.li > y->num.li;
-        else if (strncmp(op, "<", 2) == 0)  res->num.li = x->num.li < y->num.li;
-        else if (strncmp(op, ">=", 3) == 0) res->num.li = x->num.li >= y->num.li;
-        else if (strncmp(op, "<=", 3) == 0) res->num.li = x->num.li <= y->num.li;
-        else if (strncmp(op, "&&", 3) == 0) res->num.li = x->num.li && y->num.li;
-        else if (strncmp(op, "||", 3) == 0) res->num.li = x->num.li || y->num.li;
-    }
-
-    lval_del(a);
-    return res;
-}
+/*
+    The ordering [and logical] builtins are generated like the arithmetic ones, with one
+    kernel for two integers and one for when either operand is a decimal
+*/
+#define ORD_BUILTIN(name, op, int_kernel, dec_kernel)                                   \
+static Lval_t* builtin_##name(Lenv_t* e, Lval_t* a) {                                   \
+    (void)e;                                                                            \
+    LASSERT(a, a->count == 2, "Operator `%s` expects 2 arguments, got [%i]", op, a->count); \
+    LASSERT(a, IS_NUM(a, 0), "Operator `%s` expects arguments of type Number,"          \
+                             " but arg [%i] is of type [%s]",                           \
+                             op, 1, ltype_name(a->cell[0]->type));                      \
+    LASSERT(a, IS_NUM(a, 1), "Operator `%s` expects arguments of type Number,"          \
+                             " but arg [%i] is of type [%s]",                           \
+                             op, 2, ltype_name(a->cell[1]->type));                      \
+                                                                                        \
+    bool res;                                                                           \
+    if (a->cell[0]->type == LVAL_DECIMAL || a->cell[1]->type == LVAL_DECIMAL) {         \
+        double x = a->cell[0]->type == LVAL_DECIMAL ? a->cell[0]->num.f : (double)a->cell[0]->num.li; \
+        double y = a->cell[1]->type == LVAL_DECIMAL ? a->cell[1]->num.f : (double)a->cell[1]->num.li; \
+        res = dec_kernel;                                                               \
+    } else {                                                                            \
+        long x = a->cell[0]->num.li;                                                    \
+        long y = a->cell[1]->num.li;                                                    \
+        res = int_kernel;                                                               \
+    }                                                                                   \
+    lval_del(a);                                                                        \
+    return lval_create_bool(res);                                                       \
+}
+
+ORD_BUILTIN(gt,  ">",  x > y,  x > y)
+ORD_BUILTIN(lt,  "<",  x < y,  x < y)
+ORD_BUILTIN(ge,  ">=", x >= y, x >= y)
+ORD_BUILTIN(le,  "<=", x <= y, x <= y)
+ORD_BUILTIN(and, "&&", x && y, !almost_eq(x, 0.0) && !almost_eq(y, 0.0))
+ORD_BUILTIN(or,  "||", x || y, !almost_eq(x, 0.0) || !almost_eq(y, 0.0))
 
 static Lval_t* builtin_not(Lenv_t* e, Lval_t* a) {
     (void)e;
     LASSERT_NUM(__func__, a, 1);
-    if (a->cell[0]->type == LVAL_DECIMAL) {
-        a->cell[0]->type = LVAL_BOOL;
-        a->cell[0]->num.li = (long)a->cell[0]->num.f;
-    } else if (a->cell[0]->type == LVAL_INTEGER) {
-        a->cell[0]->type = LVAL_BOOL;
-        a->cell[0]->num.li = (long)a->cell[0]->num.li;
+    if (a->cell[0]->type != LVAL_DECIMAL && a->cell[0]->type != LVAL_INTEGER) {
+        LASSERT_TYPE(__func__, a, 0, LVAL_BOOL);
     }
-    LASSERT_TYPE(__func__, a, 0, LVAL_BOOL);
 
-    bool res = !(bool)(a->cell[0]->num.li);
+    Lval_t* x = a->cell[0];
+    bool res = x->type == LVAL_DECIMAL ? !(long)x->num.f : !x->num.li;
     lval_del(a);
     return lval_create_bool(res);
 }
@@ -1174,7 +1983,7 @@ static Lval_t* builtin_not(Lenv_t* e, Lval_t* a) {
 /*
     evaluate the equality of two Lvals
 */
-static int lval_eq(Lval_t* x, Lval_t* y) {
+int lval_eq(Lval_t* x, Lval_t* y) {
     if (x->type != y->type) return 0;
 
     switch (x->type) {
@@ -1193,15 +2002,13 @@ static int lval_eq(Lval_t* x, Lval_t* y) {
             if ((l1 = strlen(x->err)) != (l2 = strlen(y->err))) return false;
             return strncmp(x->err, y->err, l1) == 0;
         }
-        case LVAL_SYM: {
-            int l1, l2;
-            if ((l1 = strlen(x->sym)) != (l2 = strlen(y->sym))) return false;
-            return strncmp(x->sym, y->sym, l1) == 0;
-        }
+        case LVAL_SYM: return x->sym == y->sym;  // interned
 
         case LVAL_FN: {
-            if (x->builtin || y->builtin) return x->builtin == y->builtin;
-            else return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+            if (x->func->builtin || y->func->builtin) return x->func->builtin == y->func->builtin;
+            Lval_t* x_body = x->func->source != NULL ? x->func->source : x->func->body;
+            Lval_t* y_body = y->func->source != NULL ? y->func->source : y->func->body;
+            return lval_formals_eq(x->func, y->func) && lval_eq(x_body, y_body);
         }
 
         case LVAL_SEXPR:
@@ -1225,40 +2032,57 @@ static int lval_eq(Lval_t* x, Lval_t* y) {
     return 0;
 }
 
-static Lval_t* builtin_eq(Lenv_t* e, Lval_t* a) { return builtin_cmp(e, a, "=="); }
-static Lval_t* builtin_ne(Lenv_t* e, Lval_t* a) { return builtin_cmp(e, a, "!="); }
-
-static Lval_t* builtin_cmp(Lenv_t* e, Lval_t* a, char* op) {
-    (void)e;
-    LASSERT_NUM(op, a, 2);
-
-    bool res = false;
-    if (strncmp(op, "==", 3) == 0) res = lval_eq(a->cell[0], a->cell[1]);
-    if (strncmp(op, "!=", 3) == 0) res = !lval_eq(a->cell[0], a->cell[1]);
-
-    lval_del(a);
-    return lval_create_bool(res);
-}
+/*
+    Equality of any two values, two integers [the common case] are compared right away
+*/
+#define CMP_BUILTIN(name, op, kernel)                                                   \
+static Lval_t* builtin_##name(Lenv_t* e, Lval_t* a) {                                   \
+    (void)e;                                                                            \
+    LASSERT_NUM(op, a, 2);                                                              \
+                                                                                        \
+    Lval_t* x = a->cell[0];                                                             \
+    Lval_t* y = a->cell[1];                                                             \
+    bool eq = x->type == LVAL_INTEGER && y->type == LVAL_INTEGER                        \
+        ? x->num.li == y->num.li                                                        \
+        : lval_eq(x, y);                                                                \
+    bool res = kernel;                                                                  \
+    lval_del(a);                                                                        \
+    return lval_create_bool(res);                                                       \
+}
+
+CMP_BUILTIN(eq, "==", eq)
+CMP_BUILTIN(ne, "!=", !eq)
 
+/*
+    Only the chosen branch is evaluated, and read in place when it's shared [see lval_eval_sexpr]
+*/
 static Lval_t* builtin_if(Lenv_t* e, Lval_t* a) {
     LASSERT_NUM(__func__, a, 3);
-
-    if (a->cell[0]->type == LVAL_DECIMAL) {
-        a->cell[0]->type = LVAL_BOOL;
-        a->cell[0]->num.li = (long)a->cell[0]->num.f;
+    Lval_t* cond = a->cell[0];
+    if (cond->type != LVAL_DECIMAL && cond->type != LVAL_INTEGER) {
+        LASSERT_TYPE(__func__, a, 0, LVAL_BOOL);
     }
-    if (a->cell[0]->type == LVAL_INTEGER) a->cell[0]->type = LVAL_BOOL;
- 
-    LASSERT_TYPE(__func__, a, 0, LVAL_BOOL);
     LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
     LASSERT_TYPE(__func__, a, 2, LVAL_QEXPR);
 
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-
-    Lval_t* x = a->cell[0]->num.li ? lval_eval(e, lval_pop(a, 1))
-                                   : lval_eval(e, lval_pop(a, 2));
+    bool truth = cond->type == LVAL_DECIMAL ? (long)cond->num.f != 0 : cond->num.li != 0;
+    Lval_t* branch = lval_pop(a, truth ? 1 : 2);
     lval_del(a);
+    return lval_eval_sexpr(e, branch);
+}
+
+/*
+    `let {body}` evaluates `body` in a scope of its own, what `=` binds there is
+    gone afterwards [the VM gives it a frame instead, see OP_LET]
+*/
+static Lval_t* builtin_let(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 1);
+    LASSERT_TYPE(__func__, a, 0, LVAL_QEXPR);
+
+    Lenv_t* scope = lenv_new();
+    scope->parent = e;
+    Lval_t* x = lval_eval_sexpr(scope, lval_take(a, 0));
+    lenv_del(scope);
     return x;
 }
 
@@ -1278,13 +2102,9 @@ static Lval_t* builtin_head(Lenv_t* e, Lval_t* a) {
 
     v = lval_take(a, 0);  // upacks the input Q-expression
     switch (v->type) {
-        case LVAL_QEXPR: {
-            while (v->count > 1) {
-                lval_del(lval_pop(v, 1));
-            }
-            break;
-        }
+        case LVAL_QEXPR: return lval_slice(v, 0, 1);
         case LVAL_STR: {
+            v = lval_unshare(v);
             v->str = realloc(v->str, 2);
             v->str[1] = '\0';
             break;
@@ -1313,11 +2133,9 @@ static Lval_t* builtin_tail(Lenv_t* e, Lval_t* a) {
 
     v = lval_take(a, 0);  // upacks the input Q-expression
     switch (v->type) {
-        case LVAL_QEXPR: {
-            lval_del(lval_pop(v, 0));
-            break;
-        }
+        case LVAL_QEXPR: return lval_slice(v, 1, v->count - 1);
         case LVAL_STR: {
+            v = lval_unshare(v);
             const size_t len = strlen(v->str);
             char* temp = malloc(len * sizeof(char));
             strncpy(temp, v->str + 1, len);
@@ -1343,9 +2161,7 @@ static Lval_t* builtin_eval(Lenv_t* e, Lval_t* a) {
     LASSERT_NUM(__func__, a, 1);
     LASSERT_TYPE(__func__, a, 0, LVAL_QEXPR);
 
-    Lval_t* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return lval_eval_sexpr(e, lval_take(a, 0));
 }
 
 static Lval_t* builtin_join(Lenv_t* e, Lval_t* a) {
@@ -1357,19 +2173,424 @@ static Lval_t* builtin_join(Lenv_t* e, Lval_t* a) {
         ltype_name(LVAL_STR), i + 1, ltype_name(a->cell[i]->type));
     }
 
-    Lval_t* x = lval_pop(a, 0);
-    for (int i = 0; i < a->count; ++i) {
-        LASSERT(a, x->type == a->cell[i]->type,
+    for (int i = 1; i < a->count; ++i) {
+        LASSERT(a, a->cell[0]->type == a->cell[i]->type,
         "Function `%s` expects all arguments to be of the same type, arg [%i] "
         "is of type [%s] which is different than 1st element's type [%s]", __func__,
-        i + 2, ltype_name(a->cell[i]->type), ltype_name(x->type));
+        i + 1, ltype_name(a->cell[i]->type), ltype_name(a->cell[0]->type));
     }
 
+    Lval_t* x = lval_unshare(lval_pop(a, 0));
+
     while (a->count) { x = lval_join(x, lval_pop(a, 0)); }
     lval_del(a);
     return x;
 }
 
+/*
+    The list functions below replace the recursive ones std.pkl used to define, with the same
+    semantics: the elements are read as `st` reads them [see lval_elem], and the functions
+    given to `map`, `filter` and `foldl` are called once per element from a single loop
+*/
+
+/*
+    The value of the element `x` of a list, as `eval` of `{x}` gives it:
+    symbols and S-Expressions are evaluated in `e`, anything else is itself
+*/
+static Lval_t* lval_elem(Lenv_t* e, Lval_t* x) {
+    if (x->type == LVAL_SYM) return lenv_get(e, x);
+    if (x->type == LVAL_SEXPR) return lval_eval(e, lval_ref(x));
+    return lval_ref(x);
+}
+
+/*
+    Calls `f` with the args `a` [consumed], keeping `f` itself unbound so it can be called again
+*/
+static Lval_t* lval_call_again(Lenv_t* e, Lval_t* f, Lval_t* a) {
+    lval_ref(f);  // a second owner makes lval_call bind a copy
+    Lval_t* x = lval_call(e, f, a);
+    lval_del(f);
+    return x;
+}
+
+/*
+    Checks that the integer [arg 1] indexes one of the `n` positions of the list [arg 2]
+*/
+#define LASSERT_INDEX(fn, a, n)                                                             \
+    LASSERT(a, a->cell[0]->num.li >= 0 && a->cell[0]->num.li < (n),                         \
+            "Function `%s` got the index [%li], out of the [%i] positions of the list!",    \
+            fn, a->cell[0]->num.li, (int)(n))
+
+static int lval_len(Lval_t* v) {
+    return v->type == LVAL_STR ? (int)strlen(v->str) : v->count;
+}
+
+static Lval_t* builtin_len(Lenv_t* e, Lval_t* a) {
+    (void)e;
+    LASSERT_NUM(__func__, a, 1);
+    LASSERT(a, IS_ITERABLE(a, 0),
+            "Function `%s` expects arguments of type [%s, %s], "
+            "but arg [1] is of type [%s]", __func__, ltype_name(LVAL_QEXPR),
+            ltype_name(LVAL_STR), ltype_name(a->cell[0]->type));
+
+    Lval_t* x = lval_create_long(lval_len(a->cell[0]));
+    lval_del(a);
+    return x;
+}
+
+static Lval_t* builtin_nth(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 0, LVAL_INTEGER);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+    LASSERT_INDEX(__func__, a, a->cell[1]->count);
+
+    Lval_t* x = lval_elem(e, a->cell[1]->cell[a->cell[0]->num.li]);
+    lval_del(a);
+    return x;
+}
+
+static Lval_t* builtin_last(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 1);
+    LASSERT_TYPE(__func__, a, 0, LVAL_QEXPR);
+    LASSERT(a, a->cell[0]->count != 0, "Function `%s` expects a non-empty [%s]!",
+                                       __func__, ltype_name(LVAL_QEXPR));
+
+    Lval_t* l = a->cell[0];
+    Lval_t* x = lval_elem(e, l->cell[l->count - 1]);
+    lval_del(a);
+    return x;
+}
+
+static Lval_t* builtin_take(Lenv_t* e, Lval_t* a) {
+    (void)e;
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 0, LVAL_INTEGER);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+    LASSERT_INDEX(__func__, a, a->cell[1]->count + 1);
+
+    long n = a->cell[0]->num.li;
+    return lval_slice(lval_take(a, 1), 0, n);
+}
+
+static Lval_t* builtin_drop(Lenv_t* e, Lval_t* a) {
+    (void)e;
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 0, LVAL_INTEGER);
+    LASSERT(a, IS_ITERABLE(a, 1),
+            "Function `%s` expects arguments of type [%s, %s], "
+            "but arg [2] is of type [%s]", __func__, ltype_name(LVAL_QEXPR),
+            ltype_name(LVAL_STR), ltype_name(a->cell[1]->type));
+    LASSERT_INDEX(__func__, a, lval_len(a->cell[1]) + 1);
+
+    long n = a->cell[0]->num.li;
+    Lval_t* l = lval_take(a, 1);
+    if (l->type == LVAL_QEXPR) return lval_slice(l, n, l->count - n);
+
+    Lval_t* x = lval_create_str(l->str + n);
+    lval_del(l);
+    return x;
+}
+
+static Lval_t* builtin_in(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+
+    Lval_t* l = a->cell[1];
+    for (int i = 0; i < l->count; ++i) {
+        Lval_t* y = lval_elem(e, l->cell[i]);
+        if (y->type == LVAL_ERR) {
+            lval_del(a);
+            return y;
+        }
+        bool found = lval_eq(a->cell[0], y);
+        lval_del(y);
+        if (found) {
+            lval_del(a);
+            return lval_create_bool(true);
+        }
+    }
+    lval_del(a);
+    return lval_create_bool(false);
+}
+
+static Lval_t* builtin_map(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 0, LVAL_FN);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+
+    Lval_t* f = a->cell[0];
+    Lval_t* l = a->cell[1];
+    Lval_t* x = lval_create_qexpr();
+    lval_cells_reserve(x, l->count);
+    for (int i = 0; i < l->count; ++i) {
+        Lval_t* y = lval_elem(e, l->cell[i]);
+        if (y->type != LVAL_ERR) y = lval_call_again(e, f, lval_add(lval_create_sexpr(), y));
+        if (y->type == LVAL_ERR) {
+            lval_del(x);
+            lval_del(a);
+            return y;
+        }
+        lval_add(x, y);
+    }
+    lval_del(a);
+    return x;
+}
+
+static Lval_t* builtin_filter(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 0, LVAL_FN);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+
+    Lval_t* f = a->cell[0];
+    Lval_t* l = a->cell[1];
+    Lval_t* x = lval_create_qexpr();
+    for (int i = 0; i < l->count; ++i) {
+        Lval_t* y = lval_elem(e, l->cell[i]);
+        if (y->type != LVAL_ERR) y = lval_call_again(e, f, lval_add(lval_create_sexpr(), y));
+
+        bool keep = false;
+        switch (y->type) {
+            case LVAL_ERR: break;
+            case LVAL_BOOL:
+            case LVAL_INTEGER: keep = y->num.li; break;
+            case LVAL_DECIMAL: keep = (long)y->num.f; break;
+            default: {
+                Lval_t* err = lval_create_err("Function `%s` expects the filter to return a [%s], got [%s]",
+                                              __func__, ltype_name(LVAL_BOOL), ltype_name(y->type));
+                lval_del(y);
+                y = err;
+            }
+        }
+        if (y->type == LVAL_ERR) {
+            lval_del(x);
+            lval_del(a);
+            return y;
+        }
+        lval_del(y);
+        if (keep) lval_add(x, lval_ref(l->cell[i]));
+    }
+    lval_del(a);
+    return x;
+}
+
+static Lval_t* builtin_foldl(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 3);
+    LASSERT_TYPE(__func__, a, 0, LVAL_FN);
+    LASSERT_TYPE(__func__, a, 2, LVAL_QEXPR);
+
+    Lval_t* f = a->cell[0];
+    Lval_t* l = a->cell[2];
+    Lval_t* z = lval_ref(a->cell[1]);
+    for (int i = 0; i < l->count && z->type != LVAL_ERR; ++i) {
+        Lval_t* y = lval_elem(e, l->cell[i]);
+        if (y->type == LVAL_ERR) {
+            lval_del(z);
+            z = y;
+            break;
+        }
+        Lval_t* args = lval_add(lval_add(lval_create_sexpr(), z), y);
+        z = lval_call_again(e, f, args);
+    }
+    lval_del(a);
+    return z;
+}
+
+/*
+    The clauses of `select` and `case` are Q-Expressions of a condition [of a value to match for
+    `case`] and a result, read like `st` and `nd` would read them. They're read in place and only
+    up to the first that holds; a call site with literal clauses is compiled to jumps instead
+*/
+#define LASSERT_CLAUSES(fn, a, from)                                                            \
+    for (int i = (from); i < a->count; ++i) {                                                   \
+        LASSERT_TYPE(fn, a, i, LVAL_QEXPR);                                                     \
+        LASSERT(a, a->cell[i]->count == 2, "Function `%s` expects clauses of [2] elements, "    \
+                "clause [%i] has [%i]", fn, i + 1 - (from), a->cell[i]->count);                 \
+    }
+
+static Lval_t* builtin_select(Lenv_t* e, Lval_t* a) {
+    LASSERT_CLAUSES(__func__, a, 0);
+
+    for (int i = 0; i < a->count; ++i) {
+        Lval_t* clause = a->cell[i];
+        Lval_t* cond = lval_elem(e, clause->cell[0]);
+        if (cond->type == LVAL_ERR) {
+            lval_del(a);
+            return cond;
+        }
+
+        bool truth = false;
+        switch (cond->type) {
+            case LVAL_DECIMAL: truth = (long)cond->num.f != 0; break;
+            case LVAL_BOOL:
+            case LVAL_INTEGER: truth = cond->num.li != 0; break;
+            default: {  // the error `if` gives, as for a compiled `select` (see OP_BRANCH)
+                Lval_t* err = lval_create_err("Function `%s` expects arg of type %s. Arg [%i] is of type %s.",
+                                              "builtin_if", ltype_name(LVAL_BOOL), 1, ltype_name(cond->type));
+                lval_del(cond);
+                lval_del(a);
+                return err;
+            }
+        }
+        lval_del(cond);
+        if (truth) {
+            Lval_t* x = lval_elem(e, clause->cell[1]);
+            lval_del(a);
+            return x;
+        }
+    }
+    lval_del(a);
+    return lval_create_err("No selection found in cases");
+}
+
+static Lval_t* builtin_case(Lenv_t* e, Lval_t* a) {
+    LASSERT(a, a->count >= 1, "Function `%s` expects a value to match, got no arguments", __func__);
+    LASSERT_CLAUSES(__func__, a, 1);
+
+    for (int i = 1; i < a->count; ++i) {
+        Lval_t* clause = a->cell[i];
+        Lval_t* k = lval_elem(e, clause->cell[0]);
+        if (k->type == LVAL_ERR) {
+            lval_del(a);
+            return k;
+        }
+        bool match = lval_eq(a->cell[0], k);
+        lval_del(k);
+        if (match) {
+            Lval_t* x = lval_elem(e, clause->cell[1]);
+            lval_del(a);
+            return x;
+        }
+    }
+    lval_del(a);
+    return lval_create_err("No match found");
+}
+
+/*
+    The loops evaluate their Q-Expressions [condition, body] once per iteration in the caller's
+    env, from a C loop so that the C stack doesn't grow and nothing is copied per iteration: the
+    VM runs the code of each in a frame of its own every time, code that's compiled once for the
+    loop, or once for all its runs when the loop is part of a function (see vm_compile_shared)
+*/
+static Lchunk_t* lval_loop_compile(Lval_t* x) {
+#ifdef TREE_WALKER
+    (void)x;
+    return NULL;
+#else
+    return vm_compile_shared(x);
+#endif
+}
+
+static Lval_t* lval_loop_run(Lenv_t* e, Lval_t* x, Lchunk_t* code) {
+    if (code == NULL) return lval_eval_sexpr(e, lval_ref(x));  // a shared `x` is only read
+    return vm_run(e, code);
+}
+
+static void lval_loop_free(Lchunk_t* code) {
+    if (code != NULL) vm_chunk_del(code);
+}
+
+/*
+    Checks that the arg `idx` of a loop names a single variable, which is bound like `=` binds it
+*/
+#define LASSERT_LOOP_VAR(fn, a, idx)                                                        \
+    LASSERT_TYPE(fn, a, idx, LVAL_QEXPR);                                                   \
+    LASSERT(a, a->cell[idx]->count == 1 && a->cell[idx]->cell[0]->type == LVAL_SYM,        \
+            "Function `%s` expects a single symbol to bind, got [%i] elements",            \
+            fn, a->cell[idx]->count);                                                       \
+    LASSERT(a, !_lookup_builtin_name(a->cell[idx]->cell[0]->sym),                           \
+            "Function `%s` cannot bind '%s'; builtin keyword!",                             \
+            fn, a->cell[idx]->cell[0]->sym)
+
+/*
+    `while {cond} {body}` evaluates `body` as long as `cond` is true
+*/
+static Lval_t* builtin_while(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 2);
+    LASSERT_TYPE(__func__, a, 0, LVAL_QEXPR);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+
+    Lchunk_t* cond_code = lval_loop_compile(a->cell[0]);
+    Lchunk_t* body_code = lval_loop_compile(a->cell[1]);
+    Lval_t* res = NULL;
+    while (res == NULL) {
+        Lval_t* cond = lval_loop_run(e, a->cell[0], cond_code);
+        bool truth = false;
+        switch (cond->type) {
+            case LVAL_ERR: res = lval_ref(cond); break;
+            case LVAL_DECIMAL: truth = (long)cond->num.f != 0; break;
+            case LVAL_BOOL:
+            case LVAL_INTEGER: truth = cond->num.li != 0; break;
+            default:
+                res = lval_create_err("Function `%s` expects a condition of type %s, got %s.",
+                                      __func__, ltype_name(LVAL_BOOL), ltype_name(cond->type));
+        }
+        lval_del(cond);
+        if (res != NULL) break;
+        if (!truth) {
+            res = lval_create_ok();
+            break;
+        }
+
+        Lval_t* x = lval_loop_run(e, a->cell[1], body_code);
+        if (x->type == LVAL_ERR) res = x;
+        else lval_del(x);
+    }
+    lval_loop_free(cond_code);
+    lval_loop_free(body_code);
+    lval_del(a);
+    return res;
+}
+
+/*
+    `dotimes {i} n {body}` evaluates `body` with `i` bound to 0, 1, ... n - 1,
+    the counter itself is a C integer, only its value is bound
+*/
+static Lval_t* builtin_dotimes(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 3);
+    LASSERT_LOOP_VAR(__func__, a, 0);
+    LASSERT_TYPE(__func__, a, 1, LVAL_INTEGER);
+    LASSERT_TYPE(__func__, a, 2, LVAL_QEXPR);
+
+    Lval_t* var = a->cell[0]->cell[0];
+    Lchunk_t* code = lval_loop_compile(a->cell[2]);
+    Lval_t* res = NULL;
+    for (long i = 0; i < a->cell[1]->num.li && res == NULL; ++i) {
+        lenv_put_move(e, var, lval_create_long(i));
+
+        Lval_t* x = lval_loop_run(e, a->cell[2], code);
+        if (x->type == LVAL_ERR) res = x;
+        else lval_del(x);
+    }
+    lval_loop_free(code);
+    lval_del(a);
+    return res != NULL ? res : lval_create_ok();
+}
+
+/*
+    `for-each {x} l {body}` evaluates `body` with `x` bound to each element of the list `l` in turn
+*/
+static Lval_t* builtin_for_each(Lenv_t* e, Lval_t* a) {
+    LASSERT_NUM(__func__, a, 3);
+    LASSERT_LOOP_VAR(__func__, a, 0);
+    LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
+    LASSERT_TYPE(__func__, a, 2, LVAL_QEXPR);
+
+    Lval_t* var = a->cell[0]->cell[0];
+    Lval_t* l = a->cell[1];
+    Lchunk_t* code = lval_loop_compile(a->cell[2]);
+    Lval_t* res = NULL;
+    for (int i = 0; i < l->count && res == NULL; ++i) {
+        lenv_put_move(e, var, lval_ref(l->cell[i]));
+
+        Lval_t* x = lval_loop_run(e, a->cell[2], code);
+        if (x->type == LVAL_ERR) res = x;
+        else lval_del(x);
+    }
+    lval_loop_free(code);
+    lval_del(a);
+    return res != NULL ? res : lval_create_ok();
+}
+
 static Lval_t* builtin_def(Lenv_t* e, Lval_t* a) {
     return builtin_var(e, a, "def");
 }
@@ -1400,9 +2621,10 @@ static Lval_t* builtin_var(Lenv_t* e, Lval_t* a, char* fn) {
             fn, i + 1, symbols->cell[i]->sym);
     }
 
+    /* the values are popped off the args so the env ends up their only owner */
     for (int i = 0; i < symbols->count; ++i) {
-        if (strncmp(fn, "def", 4) == 0) lenv_def(e, symbols->cell[i], a->cell[i + 1]);
-        if (strncmp(fn, "=", 2) == 0)   lenv_put(e, symbols->cell[i], a->cell[i + 1]);
+        if (strncmp(fn, "def", 4) == 0) lenv_def_move(e, symbols->cell[i], lval_pop(a, 1));
+        if (strncmp(fn, "=", 2) == 0)   lenv_put_move(e, symbols->cell[i], lval_pop(a, 1));
     }
 
     lval_del(a);
@@ -1414,7 +2636,7 @@ static Lval_t* builtin_fn(Lenv_t* e, Lval_t* a) {
     LASSERT_TYPE(__func__, a, 0, LVAL_QEXPR);
     LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
 
-    Lval_t* symbols = a->cell[0];
+    Lval_t* symbols = a->cell[0] = lval_unshare(a->cell[0]);
 
     /* First Q-expr must only contain symbols */
     for (int i = 0; i < symbols->count; ++i) {
@@ -1432,7 +2654,11 @@ static Lval_t* builtin_fn(Lenv_t* e, Lval_t* a) {
     Lval_t* fn_name = lval_pop(symbols, 0);
     Lval_t* formals = lval_pop(a, 0);
     Lval_t* body = lval_pop(a, 0);
-    lenv_def(e, fn_name, lval_create_lambda(formals, body));
+    Lval_t* fn = lval_create_lambda(formals, body);
+    lenv_add_locals(fn->func->env, formals);
+    lval_inline_func(fn->func);  // compiles the body as well
+    lenv_def_move(e, fn_name, fn);
+    lval_del(fn_name);
     lval_del(a);
     return lval_create_ok();
 }
@@ -1450,17 +2676,28 @@ static Lval_t* builtin_lambda(Lenv_t* e, Lval_t* a) {
             __func__, i + 1, ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
     }
 
+    for (int i = 0; i < a->cell[0]->count; ++i) {
+        LASSERT(a, !_lookup_builtin_name(a->cell[0]->cell[i]->sym),
+            "Function `%s` cannot define arg number [%i] named '%s'; builtin keyword!",
+            __func__, i + 1, a->cell[0]->cell[i]->sym);
+    }
+
     Lval_t* formals = lval_pop(a, 0);
     Lval_t* body = lval_pop(a, 0);
     lval_del(a);
 
-    return lval_create_lambda(formals, body);
+    Lval_t* fn = lval_create_lambda(formals, body);
+    lenv_add_locals(fn->func->env, formals);
+#ifndef TREE_WALKER
+    fn->func->code = vm_compile_body(body, fn->func->env);
+#endif
+    return fn;
 }
 
 static Lval_t* lval_join(Lval_t* x, Lval_t* y) {
     switch (x->type) {
         case LVAL_QEXPR: {
-            while (y->count) { x = lval_add(x, lval_pop(y, 0)); }
+            for (int i = 0; i < y->count; ++i) { x = lval_add(x, lval_ref(y->cell[i])); }
             break;
         }
         case LVAL_STR: {
@@ -1478,27 +2715,43 @@ static Lval_t* lval_join(Lval_t* x, Lval_t* y) {
     return x;
 }
 
-static Lval_t* lval_copy(Lval_t* v) {
-    Lval_t* x = malloc(sizeof(Lval_t));
+/*
+    Shallow copy of `v` with a single owner, the children (cells, formals, body,
+    and the values of the function's environment) are shared with `v`
+*/
+Lval_t* lval_copy(Lval_t* v) {
+    Lval_t* x = pool_alloc(&lval_pool);
     x->type = v->type;
+    x->refs = 1;
     x->c_type = v->c_type;
 
     switch (v->type) {
         case LVAL_FN: {
-            x->is_extern = v->is_extern;
+            x->func = pool_alloc(&func_pool);
+            x->func->is_extern = v->func->is_extern;
 
-            if (v->builtin != NULL) {
-                x->builtin = v->builtin;
+            if (v->func->builtin != NULL) {
+                x->func->builtin = v->func->builtin;
             } else {
-                x->builtin = NULL;
-                x->cif = malloc(sizeof(ffi_cif));
-                memcpy(x->cif, v->cif, sizeof(ffi_cif));
-                x->atypes = malloc(v->formals->count * sizeof(ffi_type*));
-                memcpy(x->atypes, v->atypes, v->formals->count * sizeof(ffi_type*));
-                x->extern_ptr = v->extern_ptr;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
+                x->func->builtin = NULL;
+                x->func->cif = NULL;
+                x->func->atypes = NULL;
+                if (v->func->cif != NULL) {
+                    x->func->cif = malloc(sizeof(ffi_cif));
+                    memcpy(x->func->cif, v->func->cif, sizeof(ffi_cif));
+                    x->func->atypes = malloc(v->func->formals->count * sizeof(ffi_type*));
+                    memcpy(x->func->atypes, v->func->atypes, v->func->formals->count * sizeof(ffi_type*));
+                    x->func->cif->arg_types = x->func->atypes;
+                }
+                x->func->extern_ptr = v->func->extern_ptr;
+                x->func->env = lenv_copy(v->func->env);
+                x->func->formals = lval_ref(v->func->formals);
+                x->func->n_bound = v->func->n_bound;
+                x->func->body = lval_ref(v->func->body);
+                x->func->source = v->func->source != NULL ? lval_ref(v->func->source) : NULL;
+                x->func->callees = v->func->callees != NULL ? lval_ref(v->func->callees) : NULL;
+                x->func->epoch = v->func->epoch;
+                x->func->code = v->func->code != NULL ? vm_chunk_ref(v->func->code) : NULL;
             }
             break;
         }
@@ -1519,29 +2772,26 @@ static Lval_t* lval_copy(Lval_t* v) {
             strcpy(x->err, v->err);
             break;
         }
-        case LVAL_SYM: {
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym);
-            break;
-        }
+        case LVAL_SYM:       x->sym = v->sym; break;
 
         case LVAL_USER_TYPE: {
-            x->ud_ffi_t = v->ud_ffi_t;
-            x->ud_ffi_sz = v->ud_ffi_sz;
-            x->count = v->count;
-            x->cell = malloc(sizeof(Lval_t*) * x->count);
-            for (int i = 0; i < x->count; ++i) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
+            x->udt = pool_alloc(&udt_pool);
+            x->udt->ffi_t = v->udt->ffi_t;
+            x->udt->size = v->udt->size;
+            x->udt->fields = lval_ref(v->udt->fields);
             break;
         }
 
         case LVAL_QEXPR:
         case LVAL_SEXPR: {
+            x->slice = false;
+            x->count = 0;
+            x->start = 0;
+            x->cell = NULL;
+            lval_cells_reserve(x, v->count);
             x->count = v->count;
-            x->cell = malloc(sizeof(Lval_t*) * x->count);
             for (int i = 0; i < x->count; ++i) {
-                x->cell[i] = lval_copy(v->cell[i]);
+                x->cell[i] = lval_ref(v->cell[i]);
             }
             break;
         }
@@ -1557,96 +2807,245 @@ static Lval_t* lval_copy(Lval_t* v) {
     return x;
 }
 
+Lval_t* lval_ref(Lval_t* v) {
+    v->refs++;
+    return v;
+}
+
+/*
+    Copy-on-write; gives back `v` itself if the caller is its only owner, otherwise
+    a copy of it (consumes the caller's reference to `v` either way)
+*/
+Lval_t* lval_unshare(Lval_t* v) {
+    if (lval_is_unique(v)) return v;
+    Lval_t* x = lval_copy(v);
+    lval_del(v);
+    return x;
+}
+
 static void lenv_add_builtin_const(Lenv_t* e, char* name, Lval_t* val) {
-    lenv_def(e, lval_create_sym(name), val);
+    Lval_t* k = lval_create_sym(name);
+    lenv_def_move(e, k, val);
+    lval_del(k);
 }
 
 static void lenv_add_builtin(Lenv_t* e, char* name, Lbuiltin_t fn) {
     Lval_t* k = lval_create_sym(name);
-    Lval_t* v = lval_create_fn(fn);
-    lenv_put(e, k, v);
+    lenv_put_move(e, k, lval_create_fn(fn));
     lval_del(k);
-    lval_del(v);
 }
 
-static Lval_t* lenv_get(Lenv_t* e, Lval_t* k) {
-    for (int i = 0; i < e->count; ++i) {
-        if (strcmp(e->syms[i], k->sym) == 0) return lval_copy(e->vals[i]);
+/*
+    Slot of the interned symbol `sym` in `e`: either where it's stored, or the empty slot
+    where it would go. Assumes `e` has at least one empty slot.
+*/
+static int lenv_slot(Lenv_t* e, char* sym) {
+    int mask = e->capacity - 1;
+    int i = sym_atom(sym)->hash & mask;
+    while (e->syms[i] != NULL && e->syms[i] != sym) i = (i + 1) & mask;
+    return i;
+}
+
+/*
+    Index of the function local named `sym` in `e`, -1 if there's none
+*/
+int lenv_local(Lenv_t* e, char* sym) {
+    for (int i = 0; i < e->n_locals; ++i) {
+        if (e->local_syms[i] == sym) return i;
+    }
+    return -1;
+}
+
+/*
+    Flags `sym` as bound outside the global env; a function inlined under that name
+    could be shadowed from now on, so the functions it was inlined into are redone
+*/
+static void sym_set_local(char* sym) {
+    Lsym_t* atom = sym_atom(sym);
+    if (atom->flags & SYM_LOCAL) return;
+    atom->flags |= SYM_LOCAL;
+    if (atom->flags & SYM_INLINED) lval_inline_invalidate(sym);
+}
+
+/*
+    Gives the env of a user-defined function a local for each of its formals [but `&`]
+*/
+static void lenv_add_locals(Lenv_t* e, Lval_t* formals) {
+    for (int i = 0; i < formals->count; ++i) {
+        if (formals->cell[i]->sym != sym_intern("&")) e->n_locals++;
+    }
+    if (e->n_locals == 0) return;
+    e->locals = (Lval_t**)pool_cells_alloc(2 * e->n_locals);
+    e->local_syms = (char**)(e->locals + e->n_locals);
+
+    int n = 0;
+    for (int i = 0; i < formals->count; ++i) {
+        if (formals->cell[i]->sym == sym_intern("&")) continue;
+        sym_set_local(formals->cell[i]->sym);
+        e->locals[n] = NULL;
+        e->local_syms[n++] = formals->cell[i]->sym;
+    }
+}
+
+/*
+    Looks `sym` up in `e` only (not its parents), NULL if it's not bound there
+*/
+static Lval_t* lenv_lookup(Lenv_t* e, char* sym) {
+    if (e == global_env) {
+        int slot = sym_atom(sym)->global;
+        return slot >= 0 && slot < e->count ? e->vals[slot] : NULL;
+    }
+    for (int i = 0; i < e->n_locals; ++i) {
+        if (e->local_syms[i] == sym) return e->locals[i];
+    }
+    if (e->count == 0) return NULL;
+    int i = lenv_slot(e, sym);
+    return e->syms[i] != NULL ? e->vals[i] : NULL;
+}
+
+/*
+    True when every symbol bound in `other` is also bound in `e` [parents aside],
+    i.e. nothing in `other` can be seen by a lookup that starts at `e`
+*/
+bool lenv_shadows(Lenv_t* e, Lenv_t* other) {
+    for (int i = 0; i < other->n_locals; ++i) {
+        if (other->locals[i] != NULL && lenv_lookup(e, other->local_syms[i]) == NULL) return false;
+    }
+    for (int i = 0; i < other->capacity; ++i) {
+        if (other->syms[i] != NULL && lenv_lookup(e, other->syms[i]) == NULL) return false;
+    }
+    return true;
+}
+
+Lval_t* lenv_get(Lenv_t* e, Lval_t* k) {
+    /* a symbol that was never bound outside the global env can skip the chain */
+    if (global_env != NULL && !(sym_atom(k->sym)->flags & SYM_LOCAL)) {
+        Lval_t* v = lenv_lookup(global_env, k->sym);
+        if (v != NULL) return lval_ref(v);
+        return lval_create_err("Unbound symbol `%s`", k->sym);
+    }
+    for (Lenv_t* env = e; env != NULL; env = env->parent) {
+        Lval_t* v = lenv_lookup(env, k->sym);
+        if (v != NULL) return lval_ref(v);
     }
-    if (e->parent != NULL) return lenv_get(e->parent, k);
     return lval_create_err("Unbound symbol `%s`", k->sym);
 }
 
 /*
-    puts a newly defined symbol into the global environment [syntax is `def`]
+    puts a newly defined symbol into the global environment [syntax is `def`],
+    takes over the caller's reference to `v`
 */
-static void lenv_def(Lenv_t* e, Lval_t* k, Lval_t* v) {
+static void lenv_def_move(Lenv_t* e, Lval_t* k, Lval_t* v) {
+    if (global_env != NULL) e = global_env;
     while (e->parent != NULL) { e = e->parent; }
-    lenv_put(e, k, v);
+    lenv_put_move(e, k, v);
+}
+
+static void lenv_grow(Lenv_t* e) {
+    int old_capacity = e->capacity;
+    char** old_syms = e->syms;
+    Lval_t** old_vals = e->vals;
+
+    e->capacity = old_capacity ? old_capacity * 2 : ENV_INIT_SZ;
+    e->syms = (char**)pool_cells_alloc(e->capacity);
+    e->vals = (Lval_t**)pool_cells_alloc(e->capacity);
+    memset(e->syms, 0, sizeof(char*) * e->capacity);
+
+    for (int i = 0; i < old_capacity; ++i) {
+        if (old_syms[i] == NULL) continue;
+        int j = lenv_slot(e, old_syms[i]);
+        e->syms[j] = old_syms[i];
+        e->vals[j] = old_vals[i];
+    }
+    pool_cells_free((void**)old_syms, old_capacity);
+    pool_cells_free((void**)old_vals, old_capacity);
 }
 
 /*
-    puts a newly defined symbol into a local environment [syntax is `=`]
+    Globals are appended to a dense array, a symbol keeps its slot for good
+    so redefining it overrides the value in place (takes over the caller's reference to `v`)
 */
-static void lenv_put(Lenv_t* e, Lval_t* k, Lval_t* v) {
-    // lookup `k` in the env `e`
-    for (int i = 0; i < e->count; ++i) {
-        // found --> override existing symbol
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+static void lenv_put_global(Lenv_t* e, Lval_t* k, Lval_t* v) {
+    Lsym_t* atom = sym_atom(k->sym);
+    if (atom->global >= 0 && atom->global < e->count) {
+        lval_del(e->vals[atom->global]);
+        e->vals[atom->global] = v;
+        if (atom->flags & SYM_INLINED) lval_inline_invalidate(k->sym);
+        return;
     }
 
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(Lval_t*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    if (e->count == e->capacity) {
+        int capacity = e->capacity ? e->capacity * 2 : ENV_INIT_SZ;
+        e->syms = (char**)pool_cells_resize((void**)e->syms, e->capacity, capacity);
+        e->vals = (Lval_t**)pool_cells_resize((void**)e->vals, e->capacity, capacity);
+        memset(e->syms + e->capacity, 0, sizeof(char*) * (capacity - e->capacity));
+        e->capacity = capacity;
+    }
+    atom->global = e->count++;
+    e->syms[atom->global] = k->sym;
+    e->vals[atom->global] = v;
+}
+
+/*
+    puts a newly defined symbol into a local environment [syntax is `=`], it takes over the
+    caller's reference to `v`: a value the caller owns [freshly created, popped off the args]
+    is bound without touching its refcount
+*/
+static void lenv_put_move(Lenv_t* e, Lval_t* k, Lval_t* v) {
+    if (e == global_env) {
+        lenv_put_global(e, k, v);
+        return;
+    }
+    sym_set_local(k->sym);
+
+    int local = lenv_local(e, k->sym);
+    if (local >= 0) {
+        if (e->locals[local] != NULL) lval_del(e->locals[local]);
+        e->locals[local] = v;
+        return;
+    }
+
+    if ((e->count + 1) * 4 > e->capacity * 3) lenv_grow(e);
 
-    e->vals[e->count - 1] = lval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count - 1], k->sym);
+    int i = lenv_slot(e, k->sym);
+    if (e->syms[i] != NULL) {  // found --> override existing symbol
+        lval_del(e->vals[i]);
+        e->vals[i] = v;
+        return;
+    }
+
+    e->count++;
+    e->syms[i] = k->sym;
+    e->vals[i] = v;
 }
 
 static Lenv_t* lenv_copy(Lenv_t* e) {
-    Lenv_t* cpy = malloc(sizeof(Lenv_t));
+    Lenv_t* cpy = pool_alloc(&lenv_pool);
     cpy->parent = e->parent;
+    cpy->n_locals = e->n_locals;
+    cpy->locals = (Lval_t**)pool_cells_alloc(2 * e->n_locals);
+    cpy->local_syms = e->n_locals ? (char**)(cpy->locals + e->n_locals) : NULL;
+    for (int i = 0; i < e->n_locals; ++i) {
+        cpy->locals[i] = e->locals[i] != NULL ? lval_ref(e->locals[i]) : NULL;
+        cpy->local_syms[i] = e->local_syms[i];
+    }
     cpy->count = e->count;
-    cpy->syms = malloc(sizeof(char*) * cpy->count);
-    cpy->vals = malloc(sizeof(Lval_t*) * cpy->count);
+    cpy->capacity = e->capacity;
+    cpy->syms = (char**)pool_cells_alloc(cpy->capacity);
+    cpy->vals = (Lval_t**)pool_cells_alloc(cpy->capacity);
 
-    for (int i = 0; i < e->count; ++i) {
-        cpy->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(cpy->syms[i], e->syms[i]);
-        cpy->vals[i] = lval_copy(e->vals[i]);
+    for (int i = 0; i < e->capacity; ++i) {
+        cpy->syms[i] = e->syms[i];
+        if (e->syms[i] != NULL) cpy->vals[i] = lval_ref(e->vals[i]);
     }
     return cpy;
 }
 
-/*
-    NOTE: this doesn't check if a symbol has been registered already.
-*/
-static void _register_builtin_name(char* name) {
-    size_t name_len = strlen(name);
-    __builtins__.count++;
-    __builtins__.lengths = realloc(__builtins__.lengths, sizeof(int*) * __builtins__.count);
-    __builtins__.lengths[__builtins__.count - 1] = name_len;
-    __builtins__.names = realloc(__builtins__.names, sizeof(char*) * __builtins__.count);
-    __builtins__.names[__builtins__.count - 1] = malloc(name_len + 1);
-    strcpy(__builtins__.names[__builtins__.count - 1], name);
-}
-
 static bool _lookup_builtin_name(char* name) {
-    int l = strlen(name);
-    for (int i = 0; i < __builtins__.count; ++i) {
-        if (__builtins__.lengths[i] == l && strncmp(__builtins__.names[i], name, l) == 0) {
-            return true;
-        }
-    }
-    return false;
+    return sym_atom(name)->flags & SYM_BUILTIN;
 }
 
-static char* ltype_name(LVAL_e t) {
+char* ltype_name(LVAL_e t) {
     switch (t) {
         case LVAL_INTEGER:    return "Int";
         case LVAL_DECIMAL:    return "Float";
@@ -1711,7 +3110,7 @@ static Lval_t* builtin_read(Lenv_t* e, Lval_t* a) {
             "Function `%s` cannot define arg [%i] of type [%s], expected [%s]",
             __func__, 1, ltype_name(v->cell[0]->type), ltype_name(LVAL_SYM));
 
-    Lval_t* sym = lval_pop(v, 0);
+    Lval_t* sym = lval_ref(v->cell[0]);
     lval_del(a);
 
     if (_lookup_builtin_name(sym->sym)) {
@@ -1720,13 +3119,12 @@ static Lval_t* builtin_read(Lenv_t* e, Lval_t* a) {
     }
 
     char* s = freadline(stdin, READ_BUF_LEN);
-    if (s) {
-        lenv_put(e, sym, lval_create_str(s));
-        free(s);
-        return lval_create_ok();
-    } else {
-        return lval_create_err("Function `%s` coudn't read input string\n", __func__);
-    }
+    LASSERT(sym, s != NULL, "Function `%s` coudn't read input string\n", __func__);
+
+    lenv_put_move(e, sym, lval_create_str(s));
+    free(s);
+    lval_del(sym);
+    return lval_create_ok();
 }
 
 static Lval_t* builtin_print(Lenv_t* e, Lval_t* a) {
@@ -1756,7 +3154,7 @@ static Lval_t* builtin_type(Lenv_t* e, Lval_t* a) {
     Lval_t* v = a->cell[0];
     LASSERT_NUM(__func__, v, 1);
 
-    Lval_t* val = lval_pop(v, 0);
+    Lval_t* val = lval_ref(v->cell[0]);
     lval_del(a);
 
     switch (val->type) {
@@ -1772,14 +3170,17 @@ static Lval_t* builtin_type(Lenv_t* e, Lval_t* a) {
         case LVAL_DLL:
         case LVAL_TYPE:
         case LVAL_USER_TYPE:
-            return lval_create_str(ltype_name(val->type));
-
-        case LVAL_SYM:
         case LVAL_FN: {
-            for (int i = 0; i < e->count; ++i) {
-                if (strcmp(e->syms[i], val->sym) == 0) {
-                    return lval_create_str(ltype_name(e->vals[i]->type));
-                }
+            Lval_t* x = lval_create_str(ltype_name(val->type));
+            lval_del(val);
+            return x;
+        }
+
+        case LVAL_SYM: {
+            Lval_t* x = lenv_lookup(e, val->sym);
+            if (x != NULL) {
+                lval_del(val);
+                return lval_create_str(ltype_name(x->type));
             }
         }
     }
@@ -1788,8 +3189,9 @@ static Lval_t* builtin_type(Lenv_t* e, Lval_t* a) {
 }
 
 static Lval_t* lval_create_dll(void* dll) {
-    Lval_t* v = malloc(sizeof(Lval_t));
+    Lval_t* v = pool_alloc(&lval_pool);
     v->type = LVAL_DLL;
+    v->refs = 1;
     v->dll = dll;
     return v;
 }
@@ -1803,19 +3205,18 @@ static Lval_t* builtin_dll(Lenv_t* e, Lval_t* a) {
     char* name = a->cell[0]->str;
     char* path = a->cell[1]->str;
     void* dll = dlopen(path, RTLD_NOW|RTLD_GLOBAL);
-    if (!dll) {
-        return lval_create_err("[%s] -- Couldn't load DLL `%s`. ERROR: %s", __func__, name, dlerror());
-    }
+    LASSERT(a, dll != NULL, "[%s] -- Couldn't load DLL `%s`. ERROR: %s", __func__, name, dlerror());
     dlerror();
 
-    Lval_t* dll_name = lval_create_str(name);
-    lenv_def(e, dll_name, lval_create_dll(dll));
+    Lval_t* dll_name = lval_create_sym(name);
+    lenv_def_move(e, dll_name, lval_create_dll(dll));
+    lval_del(dll_name);
     lval_del(a);
     return lval_create_ok();
 }
 
 static ffi_type* lval_2_ffi_type(Lval_t* ltype) {
-    if (ltype->type == LVAL_USER_TYPE) return ltype->ud_ffi_t;
+    if (ltype->type == LVAL_USER_TYPE) return ltype->udt->ffi_t;
     return ctype_2_ffi_type(ltype->c_type);
 }
 
@@ -1827,61 +3228,67 @@ static Lval_t* builtin_extern(Lenv_t* e, Lval_t* a) {
     LASSERT_TYPE(__func__, a, 3, LVAL_QEXPR);
 
     void* dll = a->cell[0]->dll;
-    Lval_t* fn_name = lval_pop(a, 1);
-    Lval_t* inputs = lval_pop(a, 1);
-    Lval_t* outputs = lval_pop(a, 1);
+    char* fn_name = a->cell[1]->str;
+    Lval_t* inputs = a->cell[2];
+    Lval_t* outputs = a->cell[3];
 
-    Lval_t* input_types[inputs->count];
+    /* the ffi types are owned by the type values, which live in the environment */
+    ffi_type* input_types[inputs->count];
+    bool void_input = false;
     for (int i = 0; i < inputs->count; ++i) {
-        input_types[i] = lenv_get(e, inputs->cell[i]);
-        bool okay = input_types[i]->type == LVAL_TYPE || input_types[i]->type == LVAL_USER_TYPE;
+        Lval_t* t = lenv_get(e, inputs->cell[i]);
+        LVAL_e t_type = t->type;
+        bool okay = t_type == LVAL_TYPE || t_type == LVAL_USER_TYPE;
+        if (okay) {
+            input_types[i] = lval_2_ffi_type(t);
+            void_input |= t->c_type == C_VOID;
+        }
+        lval_del(t);
         LASSERT(a, okay, "Extern def of func `%s` got input arg [%i] of type [%s], expected [%s, %s]",
-                         fn_name->str, i + 1, ltype_name(input_types[i]->type),
+                         fn_name, i + 1, ltype_name(t_type),
                          ltype_name(LVAL_TYPE), ltype_name(LVAL_USER_TYPE));
     }
 
     LASSERT(a, (outputs->count == 1), "Extern def of func `%s` got [%i] output args. "
-                                      "Should get exactly 1 return type", fn_name->str, outputs->count);
-
-    Lval_t* output_types[outputs->count];
-    for (int i = 0; i < outputs->count; ++i) {
-        output_types[i] = lenv_get(e, outputs->cell[i]);
-        bool okay = output_types[i]->type == LVAL_TYPE || output_types[i]->type == LVAL_USER_TYPE;
-        LASSERT(a, okay, "Extern def of func `%s` got output arg [%i] of type [%s], expected [%s, %s]",
-                         fn_name->str, i + 1, ltype_name(output_types[i]->type),
-                         ltype_name(LVAL_TYPE), ltype_name(LVAL_USER_TYPE));
-    }
+                                      "Should get exactly 1 return type", fn_name, outputs->count);
 
-    void* ptr = dlsym(dll, fn_name->str);
-    if (dlerror() != NULL) {
-        return lval_create_err("[%s] -- Couldn't load symbol %s from DLL. ERROR: %s", __func__, fn_name->str, dlerror());
-    }
-    dlerror();
+    Lval_t* t = lenv_get(e, outputs->cell[0]);
+    LVAL_e t_type = t->type;
+    bool okay = t_type == LVAL_TYPE || t_type == LVAL_USER_TYPE;
+    ffi_type* rtype = okay ? lval_2_ffi_type(t) : NULL;
+    lval_del(t);
+    LASSERT(a, okay, "Extern def of func `%s` got output arg [%i] of type [%s], expected [%s, %s]",
+                     fn_name, 1, ltype_name(t_type), ltype_name(LVAL_TYPE), ltype_name(LVAL_USER_TYPE));
 
-    ffi_type* rtype = lval_2_ffi_type(output_types[0]);
-    Lval_t* fn = lval_create_lambda(inputs, outputs);
+    void* ptr = dlsym(dll, fn_name);
+    char* dl_err = dlerror();
+    LASSERT(a, dl_err == NULL, "[%s] -- Couldn't load symbol %s from DLL. ERROR: %s", __func__, fn_name, dl_err);
+
+    Lval_t* fn = lval_create_lambda(lval_ref(inputs), lval_ref(outputs));
     int n_args = inputs->count;
+    fn->func->cif = malloc(sizeof(ffi_cif));
+    fn->func->atypes = malloc(n_args * sizeof(ffi_type*));
 
     ffi_status status;
-    if (n_args == 1 && input_types[0]->c_type == C_VOID) {
-        status = ffi_prep_cif(fn->cif, FFI_DEFAULT_ABI, 0, rtype, NULL);
+    if (n_args == 1 && void_input) {
+        status = ffi_prep_cif(fn->func->cif, FFI_DEFAULT_ABI, 0, rtype, NULL);
     } else {
         for (int i = 0; i < n_args; ++i) {
-            fn->atypes[i] = lval_2_ffi_type(input_types[i]);
+            fn->func->atypes[i] = input_types[i];
         }
-        status = ffi_prep_cif(fn->cif, FFI_DEFAULT_ABI, n_args, rtype, fn->atypes);
+        status = ffi_prep_cif(fn->func->cif, FFI_DEFAULT_ABI, n_args, rtype, fn->func->atypes);
     }
     if (status != FFI_OK) {
-        return lval_create_err("[%s] -- Couldn't prep symbol %s through libffi `ffi_prep_cif`", __func__, fn_name->str);
+        lval_del(fn);
+        LASSERT(a, false, "[%s] -- Couldn't prep symbol %s through libffi `ffi_prep_cif`", __func__, fn_name);
     }
 
-    fn->extern_ptr = ptr;
-    fn->is_extern = true;
-    lenv_def(e, fn_name, fn);
-
-    lval_del(fn_name);
-    lval_del(inputs);
-    lval_del(outputs);
+    fn->func->extern_ptr = ptr;
+    fn->func->is_extern = true;
+    Lval_t* fn_sym = lval_create_sym(fn_name);
+    lenv_def_move(e, fn_sym, fn);
+    lval_del(fn_sym);
+    lval_del(a);
 
     return lval_create_ok();
 }
@@ -1892,8 +3299,8 @@ static Lval_t* builtin_mktype(Lenv_t* e, Lval_t* a) {
     LASSERT_TYPE(__func__, a, 1, LVAL_QEXPR);
 
     // TODO: make sure that the type hasn't been defined ?? or fuck it, it's the user's responsibility ??
-    Lval_t* type_name = lval_pop(a, 0);
-    Lval_t* types = lval_pop(a, 0);
+    char* type_name = a->cell[0]->str;
+    Lval_t* types = a->cell[1];
     int n_types = types->count;
 
     // TODO: pass name to add to the type
@@ -1905,20 +3312,19 @@ static Lval_t* builtin_mktype(Lenv_t* e, Lval_t* a) {
     for (int i = 0; i < n_types; ++i) {
         sub_type = lenv_get(e, types->cell[i]);
         bool okay = sub_type->type == LVAL_TYPE;
+        lval_add(ltype->udt->fields, sub_type);
+        if (!okay) lval_del(ltype);
         LASSERT(a, okay, "mktype of `%s` got arg [%i] of type [%s], expected [%s]",
-                         type_name->str, i + 1, ltype_name(types->cell[i]->type), ltype_name(LVAL_TYPE));
+                         type_name, i + 1, ltype_name(types->cell[i]->type), ltype_name(LVAL_TYPE));
 
         ctypes[i] = sub_type->c_type;
         sz += sizeof_ctype(ctypes[i]);
-        lval_add(ltype, sub_type);
     }
 
-    ltype->ud_ffi_t = ffi_type_from_user_defined(ctypes, n_types);
-    ltype->ud_ffi_sz = sz;
-    lenv_add_builtin_const(e, type_name->str, ltype);
-
-    lval_del(type_name);
-    lval_del(types);
+    ltype->udt->ffi_t = ffi_type_from_user_defined(ctypes, n_types);
+    ltype->udt->size = sz;
+    lenv_add_builtin_const(e, type_name, ltype);
+    lval_del(a);
 
     return lval_create_ok();
 }
@@ -1931,6 +3337,7 @@ static Lval_t* builtin_cast(Lenv_t* e, Lval_t* a) {
 
     Lval_t* val = lval_pop(a, 0);
     Lval_t* out_type = lval_pop(a, 0);
+    lval_del(a);
 
     switch (out_type->c_type) {
         case C_CHAR:
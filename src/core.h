@@ -1,12 +1,15 @@
 #pragma once
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <assert.h>
 #include <dlfcn.h>
 #include <ffi.h>
 
 #include "config.h"
 #include "ctypes.h"
+#include "symbols.h"
+#include "pool.h"
 #include "mpc.h"
 
 #define min(a, b) ((a) > (b) ? (b) : (a))
@@ -44,17 +47,13 @@ extern mpc_parser_t* pickle_lisp;
 
 struct Lval_t;
 struct Lenv_t;
+struct Lchunk_t;
 typedef struct Lval_t Lval_t;
 typedef struct Lenv_t Lenv_t;
+typedef struct Lchunk_t Lchunk_t;
 
 typedef Lval_t* (*Lbuiltin_t)(Lenv_t*, Lval_t*);
 
-typedef struct {
-    char** names;
-    int* lengths;
-    int count;
-} Builtins_record_t;
-
 typedef enum {
     LVAL_INTEGER,
     LVAL_DECIMAL,
@@ -77,61 +76,124 @@ typedef union {
     double f;
 } Numeric_u;
 
-// NOTE: might be better to use a hashmap here, gotta implement it though
+/*
+    Open-addressing hash map from interned symbols (see symbols.h) to values,
+    keys are compared by pointer and a NULL key marks an empty slot.
+
+    The env of a user-defined function also has one local per formal, kept apart
+    in an array so that its compiled body reads them by position (see OP_LOCAL)
+
+    The global env (see lenv_new_global) isn't hashed: `syms`/`vals` are a dense array of
+    slots, and each symbol remembers its own slot, so a global is read with one index
+*/
 struct Lenv_t {
     Lenv_t* parent;
+    int n_locals;
+    Lval_t** locals;  // NULL until bound, followed by the `n_locals` names in the same allocation
+    char** local_syms;
     int count;
+    int capacity;  // always a power of 2
     char** syms;
     Lval_t** vals;
 };
 
-struct Lval_t {
-    // char* name;  // TODO: add the name `symbol` of anything registered
-    LVAL_e type;
-    CTypes_e c_type;
-
-    /* Lval_t can only represent one at a time */
-    union {
-        Numeric_u num;
-        char* str;
-        char* err;
-        char* sym;
-        Lbuiltin_t builtin;
-        void* dll;
-        ffi_type* ud_ffi_t;  // describes a user-defined ffi_type [a struct]
-    };
-
-    /* Functions' stuff (along with builtin) */
+/*
+    Everything a function needs besides its type; builtins only use `builtin`,
+    user-defined and extern functions use the rest
+*/
+typedef struct {
+    Lbuiltin_t builtin;
     Lenv_t* env;
     Lval_t* formals;  // used to define a function's input variables (fn), and signature (extern)
+    int n_bound;  // leading formals already bound by partial application, their values are env's locals
     Lval_t* body;  // used to contain the function's body (fn), and return type (extern)
+    Lval_t* source;  // the body as written when calls were inlined into `body` [NULL if none were], see lval_inline
+    Lval_t* callees;  // the names of the functions inlined into `body` [NULL if none were]
+    int epoch;  // the `inline_epoch` the callees were last checked at [see lval_inline_refresh]
+    Lchunk_t* code;  // the body compiled to bytecode (see vm.h)
 
-    /* libffi and extern function linking stuff (along with dll) */
+    /* libffi and extern function linking stuff [NULL/false for anything but externs] */
     ffi_cif* cif;
     ffi_type** atypes;
     bool is_extern;
     void* extern_ptr;
+} Lfunc_t;
 
-    size_t ud_ffi_sz;  // the size of the entire user-defined type
+/*
+    A user-defined C type [a struct], made by `mktype`
+*/
+typedef struct {
+    ffi_type* ffi_t;  // describes the struct to libffi
+    size_t size;  // the size of the entire user-defined type
+    Lval_t* fields;  // Q-Expression of the types of the fields
+} Ludt_t;
+
+/*
+    Values are reference-counted and shared by everything that reads them (environments,
+    the VM's stack and constants, the cells of other expressions). A value must only be
+    mutated in place while it has a single owner, see `lval_unshare`.
+
+    The header is a single word, anything that doesn't fit in the 16 bytes
+    of the payload lives in a separately allocated descriptor.
+*/
+struct Lval_t {
+    LVAL_e type : 8;
+    CTypes_e c_type : 8;  // the C type described by a `Type` or a user-defined type
+    unsigned int cap_log2 : 8;  // the cell array of an expression spans 1 << cap_log2 slots
+    unsigned int slice : 1;  // the expression views part of a shared cell array, see lval_slice
+    int refs;  // number of owners, the value is freed when the last one lets go of it
 
-    /* Expression */
-    int count;
-    struct Lval_t** cell;
+    /* Lval_t can only represent one at a time */
+    union {
+        Numeric_u num;
+        char* str;
+        char* err;
+        char* sym;
+        void* dll;
+        Lfunc_t* func;
+        Ludt_t* udt;
+
+        /* Expression, see lval_cells_reserve */
+        struct {
+            int count;
+            int start;  // elements popped [or sliced] off the front, the array begins at `cell - start`
+            struct Lval_t** cell;
+        };
+    };
 };
 
 
 Lval_t* lval_eval(Lenv_t* e, Lval_t* v);
 Lval_t* lval_read(mpc_ast_t* ast);
 Lenv_t* lenv_new(void);
+Lenv_t* lenv_new_global(void);
 Lval_t* lval_add(Lval_t* v, Lval_t* x);
+void    lval_cells_reserve(Lval_t* v, int n);
+void    lval_cells_free(Lval_t* v);
 Lval_t* lval_create_sexpr(void);
 Lval_t* lval_create_qexpr(void);
 Lval_t* lval_create_str(char* s);
+Lval_t* lval_create_long(long x);
+Lval_t* lval_create_bool(bool x);
 Lval_t* builtin_load(Lenv_t* e, Lval_t* a);
+Lval_t* lval_copy(Lval_t* v);
+Lval_t* lval_ref(Lval_t* v);
+Lval_t* lval_unshare(Lval_t* v);
+bool    lval_is_unique(Lval_t* v);
+Lval_t* lval_create_err(char* fmt, ...);
+Lval_t* lval_call(Lenv_t* e, Lval_t* f, Lval_t* a);
+Lval_t* lval_logic_operand(Lval_t* x, bool or, int i, bool* truth);
+int     lval_eq(Lval_t* x, Lval_t* y);
+Lval_t* lval_bind(Lenv_t* e, Lval_t* fn, Lval_t* a);
+void    lval_inline_refresh(Lfunc_t* f);
+Lval_t* lenv_get(Lenv_t* e, Lval_t* k);
+bool    lenv_shadows(Lenv_t* e, Lenv_t* other);
+int     lenv_local(Lenv_t* e, char* sym);
+Lval_t* eval_stack_check(void);
+char*   ltype_name(LVAL_e t);
 void    lval_del(Lval_t* v);
 void    lval_print(Lval_t* v);
 void    lval_println(Lval_t* v);
 void    lenv_del(Lenv_t* e);
 void    lenv_add_builtins(Lenv_t* e);
 void    _register_builtin_names_from_env(Lenv_t* e);
-void    _del_builtin_names(void);
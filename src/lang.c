@@ -5,9 +5,6 @@ static mpc_parser_t* parsers[NUM_PARSERS];
 
 mpc_parser_t* pickle_lisp;
 
-// defined in core.c
-extern void _del_builtin_names();
-
 
 static mpc_parser_t* create_lang(void);
 static void load_std_library(Lenv_t* e);
@@ -17,7 +14,7 @@ static void load_std_library(Lenv_t* e);
 */
 void create_vm(Lenv_t** e, mpc_parser_t** lang) {
     *lang = create_lang();
-    *e = lenv_new();
+    *e = lenv_new_global();
     lenv_add_builtins(*e);
     load_std_library(*e);
     _register_builtin_names_from_env(*e);
@@ -27,7 +24,11 @@ void cleanup(void) {
     for (int i = 0; i < NUM_PARSERS; ++i) {
         mpc_cleanup(1, parsers[i]);
     }
-    _del_builtin_names();
+    vm_cleanup();
+    sym_table_del();
+#ifdef POOL_STATS
+    pool_print_stats(stderr);
+#endif
 }
 
 
@@ -81,5 +82,6 @@ static void load_std_library(Lenv_t* e) {
                         "Expected location: %s/%s\n", cwd, std_lib_path);
         exit(69);
     }
+    lval_del(res);
 }
 
@@ -5,6 +5,7 @@
 
 #include "config.h"
 #include "core.h"
+#include "vm.h"
 #include "mpc.h"
 
 #ifdef _WIN32
@@ -0,0 +1,112 @@
+#include "pool.h"
+
+#define POOL_N_CLASSES  5  // pointer arrays of 1, 2, 4, 8 and 16 slots, bigger ones use malloc
+
+static Lpool_t cell_pools[POOL_N_CLASSES] = {
+    { .name = "cells[1]",  .size = sizeof(void*) * 1 },
+    { .name = "cells[2]",  .size = sizeof(void*) * 2 },
+    { .name = "cells[4]",  .size = sizeof(void*) * 4 },
+    { .name = "cells[8]",  .size = sizeof(void*) * 8 },
+    { .name = "cells[16]", .size = sizeof(void*) * 16 },
+};
+
+static Lpool_t* pools = NULL;
+
+static void new_slab(Lpool_t* p) {
+    p->slab = malloc(POOL_SLAB_SZ);
+    if (p->slab == NULL) {
+        fprintf(stderr, "Couldn't allocate %i bytes. Buy more RAM!, %s", POOL_SLAB_SZ, __func__);
+        exit(69);
+    }
+    p->slab_left = POOL_SLAB_SZ;
+}
+
+void* pool_alloc(Lpool_t* p) {
+    if (!p->registered) {
+        p->registered = true;
+        p->next = pools;
+        pools = p;
+    }
+
+#ifdef POOL_BYPASS
+    p->misses++;
+    return malloc(p->size);
+#else
+    if (p->free_list != NULL) {
+        void* x = p->free_list;
+        p->free_list = *(void**)x;
+        p->hits++;
+        return x;
+    }
+
+    p->misses++;
+    if (p->slab_left < p->size) new_slab(p);
+    void* x = p->slab;
+    p->slab += p->size;
+    p->slab_left -= p->size;
+    return x;
+#endif
+}
+
+void pool_free(Lpool_t* p, void* x) {
+    p->frees++;
+#ifdef POOL_BYPASS
+    free(x);
+#else
+    *(void**)x = p->free_list;
+    p->free_list = x;
+#endif
+}
+
+/*
+    Size class of an array of `n` > 0 slots, POOL_N_CLASSES and above are malloc'ed
+*/
+static int cell_class(int n) {
+    int c = 0;
+    while ((1 << c) < n) c++;
+    return c;
+}
+
+void** pool_cells_alloc(int n) {
+    if (n == 0) return NULL;
+    int c = cell_class(n);
+    if (c >= POOL_N_CLASSES) return malloc(sizeof(void*) * n);
+    return pool_alloc(&cell_pools[c]);
+}
+
+void pool_cells_free(void** cells, int n) {
+    if (cells == NULL) return;
+    int c = cell_class(n);
+    if (c >= POOL_N_CLASSES) free(cells);
+    else pool_free(&cell_pools[c], cells);
+}
+
+/*
+    Resizes an array of `old_n` slots to `new_n` slots, arrays only move when they change size class
+*/
+void** pool_cells_resize(void** cells, int old_n, int new_n) {
+    if (cells == NULL) return pool_cells_alloc(new_n);
+    if (new_n == 0) {
+        pool_cells_free(cells, old_n);
+        return NULL;
+    }
+
+    int old_c = cell_class(old_n);
+    int new_c = cell_class(new_n);
+    if (old_c == new_c && old_c < POOL_N_CLASSES) return cells;
+    if (old_c >= POOL_N_CLASSES && new_c >= POOL_N_CLASSES) return realloc(cells, sizeof(void*) * new_n);
+
+    void** x = pool_cells_alloc(new_n);
+    memcpy(x, cells, sizeof(void*) * (old_n < new_n ? old_n : new_n));
+    pool_cells_free(cells, old_n);
+    return x;
+}
+
+void pool_print_stats(FILE* fp) {
+    fprintf(fp, "%-12s %12s %12s %12s %9s\n", "pool", "hits", "misses", "frees", "hit rate");
+    for (Lpool_t* p = pools; p != NULL; p = p->next) {
+        unsigned long total = p->hits + p->misses;
+        fprintf(fp, "%-12s %12lu %12lu %12lu %8.2f%%\n", p->name, p->hits, p->misses, p->frees,
+                total ? 100.0 * p->hits / total : 0.0);
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+    ASan can only catch the misuse of memory that goes through malloc/free,
+    so sanitized builds skip the pools (the counters still work)
+*/
+#if defined(__SANITIZE_ADDRESS__) && !defined(POOL_BYPASS)
+#define POOL_BYPASS
+#endif
+
+/*
+    Fixed-size object pool: objects are carved out of big slabs and recycled through
+    a free list threaded through the freed objects themselves. Slabs are never returned
+    to the system, they're reused for the lifetime of the process.
+*/
+typedef struct Lpool_t {
+    char* name;
+    size_t size;
+    void* free_list;
+    char* slab;  // the unused tail of the current slab
+    size_t slab_left;
+
+    unsigned long hits;    // allocations served from the free list
+    unsigned long misses;  // allocations that had to carve a new object
+    unsigned long frees;
+
+    bool registered;
+    struct Lpool_t* next;  // pools that have been used, for `pool_print_stats`
+} Lpool_t;
+
+#define POOL_INIT(type) { .name = #type, .size = sizeof(type) }
+
+void*  pool_alloc(Lpool_t* p);
+void   pool_free(Lpool_t* p, void* x);
+void** pool_cells_alloc(int n);
+void** pool_cells_resize(void** cells, int old_n, int new_n);
+void   pool_cells_free(void** cells, int n);
+void   pool_print_stats(FILE* fp);
@@ -0,0 +1,76 @@
+#include "symbols.h"
+
+#define SYM_TABLE_INIT  256     // initial number of slots of the intern table (doubles at 3/4 load)
+
+static struct {
+    Lsym_t** slots;
+    int count;
+    int capacity;
+} table = {
+    .slots = NULL,
+    .count = 0,
+    .capacity = 0,
+};
+
+// Ref: https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+static unsigned long fnv1a(char* s, size_t len) {
+    unsigned long h = 14695981039346656037UL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static void table_grow(void) {
+    int old_capacity = table.capacity;
+    Lsym_t** old_slots = table.slots;
+
+    table.capacity = old_capacity ? old_capacity * 2 : SYM_TABLE_INIT;
+    table.slots = calloc(table.capacity, sizeof(Lsym_t*));
+
+    for (int i = 0; i < old_capacity; ++i) {
+        if (old_slots[i] == NULL) continue;
+        int j = old_slots[i]->hash & (table.capacity - 1);
+        while (table.slots[j] != NULL) j = (j + 1) & (table.capacity - 1);
+        table.slots[j] = old_slots[i];
+    }
+    free(old_slots);
+}
+
+/*
+    Returns the unique copy of `name`, creating it on first use
+*/
+char* sym_intern(char* name) {
+    if ((table.count + 1) * 4 > table.capacity * 3) table_grow();
+
+    size_t len = strlen(name);
+    unsigned long h = fnv1a(name, len);
+    int i = h & (table.capacity - 1);
+    while (table.slots[i] != NULL) {
+        Lsym_t* s = table.slots[i];
+        if (s->hash == h && s->len == len && memcmp(s->name, name, len) == 0) return s->name;
+        i = (i + 1) & (table.capacity - 1);
+    }
+
+    Lsym_t* s = malloc(sizeof(Lsym_t) + len + 1);
+    s->hash = h;
+    s->len = len;
+    s->flags = 0;
+    s->global = -1;
+    s->epoch = 0;
+    memcpy(s->name, name, len + 1);
+    table.slots[i] = s;
+    table.count++;
+    return s->name;
+}
+
+void sym_table_del(void) {
+    for (int i = 0; i < table.capacity; ++i) {
+        free(table.slots[i]);
+    }
+    free(table.slots);
+    table.slots = NULL;
+    table.count = 0;
+    table.capacity = 0;
+}
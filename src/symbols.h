@@ -0,0 +1,34 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "config.h"
+
+/*
+    Interned symbol: every symbol name exists exactly once, so two symbols are
+    the same iff their names are the same pointer. The name is stored inline
+    right after the header, `sym_atom` gets back from a name to its header.
+*/
+typedef enum {
+    SYM_BUILTIN = 1 << 0,  // builtin/stdlib name, the user cannot rebind it
+    SYM_LOCAL   = 1 << 1,  // has been bound outside the global env [a formal, or put with `=`]
+    SYM_INLINED = 1 << 2,  // global function whose calls were inlined into some body [see lval_inline]
+} SYM_FLAGS_e;
+
+typedef struct {
+    unsigned long hash;
+    size_t len;
+    int flags;
+    int global;  // index of the symbol's slot in the global env, -1 until it's defined there
+    int epoch;  // the inline epoch the function it names last changed at, once inlined [see lval_inline_invalidate]
+    char name[];
+} Lsym_t;
+
+char*   sym_intern(char* name);
+void    sym_table_del(void);
+
+static inline Lsym_t* sym_atom(char* sym) {
+    return (Lsym_t*)(sym - offsetof(Lsym_t, name));
+}
@@ -0,0 +1,933 @@
+#include "vm.h"
+
+#define VM_STACK_INIT   256     // initial number of slots of the value stack (doubles when exhausted)
+#define VM_FRAMES_INIT  64      // initial number of call frames (doubles when exhausted)
+#define EVAL_CACHE_SZ   256     // compiled shared expressions kept for `eval` (see eval_chunk), a power of 2
+
+typedef struct {
+    Lchunk_t* chunk;
+    int depth;  // height of the value stack at the current instruction
+    Lenv_t* locals;  // env whose locals the frames running the chunk have [NULL for none]
+} Compiler_t;
+
+typedef struct {
+    Lval_t* fn;  // the callee that owns the frame's env [NULL for top-level and `eval`ed code]
+    Lchunk_t* chunk;  // a reference is held for as long as the frame runs it
+    Lenv_t* env;
+    Lenv_t* scope;  // the env when the frame owns it itself [a `let` scope, freed with the frame]
+    int ip;
+} Lframe_t;
+
+/*
+    The value stack and the call frames are shared by all (nested) runs,
+    a builtin calling back into the VM simply continues on top of them
+*/
+static struct {
+    Lval_t** stack;
+    int sp;
+    int stack_cap;
+    Lframe_t* frames;
+    int fp;
+    int frames_cap;
+} vm = {
+    .stack = NULL,
+    .sp = 0,
+    .stack_cap = 0,
+    .frames = NULL,
+    .fp = 0,
+    .frames_cap = 0,
+};
+
+/*
+    Direct-mapped cache of the code of the expressions `eval` ran, keyed by the expression
+    itself. An entry holds a reference to its key, so the key is never mutated in place
+    [see lval_unshare] nor freed while it's cached, and its code stays valid.
+*/
+static struct {
+    Lval_t* key;
+    Lchunk_t* chunk;
+} eval_cache[EVAL_CACHE_SZ];
+
+/* number of operands of each instruction (see vm.h) */
+static const int op_operands[] = {
+    [OP_CONST] = 1, [OP_LOAD] = 1, [OP_LOCAL] = 1, [OP_CALL] = 1, [OP_TAIL_CALL] = 1,
+    [OP_BINOP] = 2, [OP_BINOP_INT] = 2, [OP_BINOP_ANY] = 2,
+    [OP_EVAL] = 0, [OP_TAIL_EVAL] = 0, [OP_LET] = 0,
+    [OP_DROP] = 1, [OP_BRANCH] = 2, [OP_LOGIC] = 2, [OP_TRUTH] = 1, [OP_MATCH] = 2,
+    [OP_JUMP] = 1, [OP_RETURN] = 0,
+};
+
+static void compile_expr(Compiler_t* cc, Lval_t* v, bool tail);
+static void compile_sexpr(Compiler_t* cc, Lval_t* v, bool tail);
+static void compile_call(Compiler_t* cc, Lval_t* v, bool tail);
+
+static Lchunk_t* chunk_new(void) {
+    Lchunk_t* c = malloc(sizeof(Lchunk_t));
+    c->refs = 1;
+    c->code = NULL;
+    c->count = 0;
+    c->capacity = 0;
+    c->consts = NULL;
+    c->n_consts = 0;
+    c->max_stack = 0;
+    return c;
+}
+
+static int emit(Compiler_t* cc, int word) {
+    Lchunk_t* c = cc->chunk;
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 16;
+        c->code = realloc(c->code, sizeof(int) * c->capacity);
+    }
+    c->code[c->count] = word;
+    return c->count++;
+}
+
+static int add_const(Compiler_t* cc, Lval_t* v) {
+    Lchunk_t* c = cc->chunk;
+    c->n_consts++;
+    c->consts = realloc(c->consts, sizeof(Lval_t*) * c->n_consts);
+    c->consts[c->n_consts - 1] = v;
+    return c->n_consts - 1;
+}
+
+static void stack_effect(Compiler_t* cc, int delta) {
+    cc->depth += delta;
+    cc->chunk->max_stack = max(cc->chunk->max_stack, cc->depth);
+}
+
+/*
+    Frees an expression container whose children were moved into a chunk
+*/
+static void del_container(Lval_t* v) {
+    lval_cells_free(v);
+    lval_del(v);
+}
+
+static bool is_sym(Lval_t* v, char* name) {
+    return v->type == LVAL_SYM && v->sym == sym_intern(name);
+}
+
+/*
+    Compiles `v` the way `lval_walk` would evaluate it, takes ownership of `v`,
+    `tail` is set when the value of `v` is returned as is by the chunk
+*/
+static void compile_expr(Compiler_t* cc, Lval_t* v, bool tail) {
+    switch (v->type) {
+        case LVAL_SYM: {
+            int local = cc->locals != NULL ? lenv_local(cc->locals, v->sym) : -1;
+            if (local >= 0) {
+                emit(cc, OP_LOCAL);
+                emit(cc, local);
+                lval_del(v);
+            } else {
+                emit(cc, OP_LOAD);
+                emit(cc, add_const(cc, v));
+            }
+            stack_effect(cc, 1);
+            break;
+        }
+        case LVAL_SEXPR: compile_sexpr(cc, v, tail); break;
+        default: {
+            emit(cc, OP_CONST);
+            emit(cc, add_const(cc, v));
+            stack_effect(cc, 1);
+            break;
+        }
+    }
+}
+
+/*
+    `if` with literal branches becomes a jump, the branches are never
+    materialized as Q-Expressions (builtin names cannot be rebound)
+*/
+static void compile_if(Compiler_t* cc, Lval_t* v, bool tail) {
+    lval_del(v->cell[0]);
+    compile_expr(cc, v->cell[1], false);
+
+    emit(cc, OP_BRANCH);
+    int else_at = emit(cc, 0);
+    int end_at = emit(cc, 0);
+    stack_effect(cc, -1);
+
+    compile_sexpr(cc, v->cell[2], tail);
+    emit(cc, OP_JUMP);
+    int jump_at = emit(cc, 0);
+    stack_effect(cc, -1);
+
+    cc->chunk->code[else_at] = cc->chunk->count;
+    compile_sexpr(cc, v->cell[3], tail);
+
+    cc->chunk->code[end_at] = cc->chunk->count;
+    cc->chunk->code[jump_at] = cc->chunk->count;
+    del_container(v);
+}
+
+/*
+    `&&` and `||` only evaluate their right operand when the left one doesn't decide the result
+*/
+static void compile_logic(Compiler_t* cc, Lval_t* v) {
+    bool or = is_sym(v->cell[0], "||");
+    lval_del(v->cell[0]);
+    compile_expr(cc, v->cell[1], false);
+
+    emit(cc, OP_LOGIC);
+    emit(cc, or);
+    int end_at = emit(cc, 0);
+    stack_effect(cc, -1);
+
+    compile_expr(cc, v->cell[2], false);
+    emit(cc, OP_TRUTH);
+    emit(cc, or);
+
+    cc->chunk->code[end_at] = cc->chunk->count;
+    del_container(v);
+}
+
+/*
+    Whether the elements of `v` from the `from`th on are literal clauses of `select`/`case`
+*/
+static bool is_clauses(Lval_t* v, int from) {
+    for (int i = from; i < v->count; ++i) {
+        if (v->cell[i]->type != LVAL_QEXPR || v->cell[i]->count != 2) return false;
+    }
+    return true;
+}
+
+/*
+    `select` with literal clauses is a chain of branches, a condition is
+    evaluated only if the ones before it were false (see builtin_select)
+*/
+static void compile_select(Compiler_t* cc, Lval_t* v, bool tail) {
+    lval_del(v->cell[0]);
+    int ends[2 * v->count];
+    int n_ends = 0;
+    for (int i = 1; i < v->count; ++i) {
+        Lval_t* clause = v->cell[i];
+        compile_expr(cc, lval_ref(clause->cell[0]), false);
+        emit(cc, OP_BRANCH);
+        int else_at = emit(cc, 0);
+        ends[n_ends++] = emit(cc, 0);
+        stack_effect(cc, -1);
+
+        compile_expr(cc, lval_ref(clause->cell[1]), tail);
+        emit(cc, OP_JUMP);
+        ends[n_ends++] = emit(cc, 0);
+        stack_effect(cc, -1);
+
+        cc->chunk->code[else_at] = cc->chunk->count;
+        lval_del(clause);
+    }
+    emit(cc, OP_CONST);
+    emit(cc, add_const(cc, lval_create_err("No selection found in cases")));
+    stack_effect(cc, 1);
+
+    for (int i = 0; i < n_ends; ++i) {
+        cc->chunk->code[ends[i]] = cc->chunk->count;
+    }
+    del_container(v);
+}
+
+/*
+    `case` with literal clauses keeps the value to match on the stack
+    and tests the clauses in turn (see builtin_case)
+*/
+static void compile_case(Compiler_t* cc, Lval_t* v, bool tail) {
+    lval_del(v->cell[0]);
+    compile_expr(cc, v->cell[1], false);
+
+    int ends[2 * v->count];
+    int n_ends = 0;
+    for (int i = 2; i < v->count; ++i) {
+        Lval_t* clause = v->cell[i];
+        compile_expr(cc, lval_ref(clause->cell[0]), false);
+        emit(cc, OP_MATCH);
+        int else_at = emit(cc, 0);
+        ends[n_ends++] = emit(cc, 0);
+        stack_effect(cc, -2);
+
+        compile_expr(cc, lval_ref(clause->cell[1]), tail);
+        emit(cc, OP_JUMP);
+        ends[n_ends++] = emit(cc, 0);
+
+        cc->chunk->code[else_at] = cc->chunk->count;
+        lval_del(clause);
+    }
+    emit(cc, OP_DROP);
+    ends[n_ends++] = emit(cc, 0);
+    emit(cc, OP_CONST);
+    emit(cc, add_const(cc, lval_create_err("No match found")));
+
+    for (int i = 0; i < n_ends; ++i) {
+        cc->chunk->code[ends[i]] = cc->chunk->count;
+    }
+    del_container(v);
+}
+
+/*
+    `eval` runs the expression in a new frame [or in place of the current one
+    in tail position] instead of recursing through `builtin_eval`
+*/
+static void compile_eval(Compiler_t* cc, Lval_t* v, bool tail) {
+    lval_del(v->cell[0]);
+    compile_expr(cc, v->cell[1], false);
+    emit(cc, tail ? OP_TAIL_EVAL : OP_EVAL);
+    del_container(v);
+}
+
+/*
+    `let` runs its body in a new frame with a scope of its own instead of calling `builtin_let`
+*/
+static void compile_let(Compiler_t* cc, Lval_t* v) {
+    lval_del(v->cell[0]);
+    compile_expr(cc, v->cell[1], false);
+    emit(cc, OP_LET);
+    del_container(v);
+}
+
+/*
+    Applies the (already compiled) head of `v` to the rest of its elements
+*/
+static void compile_call(Compiler_t* cc, Lval_t* v, bool tail) {
+    for (int i = 1; i < v->count; ++i) {
+        compile_expr(cc, v->cell[i], false);
+    }
+    emit(cc, tail ? OP_TAIL_CALL : OP_CALL);
+    emit(cc, v->count - 1);
+    stack_effect(cc, -(v->count - 1));
+    del_container(v);
+}
+
+/*
+    The builtin that OP_BINOP applies for the symbol `v`, -1 for any other value
+*/
+static int binop_of(Lval_t* v) {
+    static char* names[] = {
+        [BINOP_ADD] = "+",  [BINOP_SUB] = "-",  [BINOP_MUL] = "*",  [BINOP_DIV] = "/",
+        [BINOP_MOD] = "%",  [BINOP_GT]  = ">",  [BINOP_LT]  = "<",  [BINOP_GE]  = ">=",
+        [BINOP_LE]  = "<=", [BINOP_EQ]  = "==", [BINOP_NE]  = "!=",
+    };
+    if (v->type != LVAL_SYM) return -1;
+    for (int op = 0; op < (int)(sizeof(names) / sizeof(names[0])); ++op) {
+        if (v->sym == sym_intern(names[op])) return op;
+    }
+    return -1;
+}
+
+/*
+    A call of an arithmetic/comparison builtin with 2 args, the head is kept as a constant
+    for the generic path, which still needs a slot for the function under the args
+*/
+static void compile_binop(Compiler_t* cc, Lval_t* v, int op) {
+    int k = add_const(cc, v->cell[0]);
+    stack_effect(cc, 1);
+    compile_expr(cc, v->cell[1], false);
+    compile_expr(cc, v->cell[2], false);
+    emit(cc, OP_BINOP);
+    emit(cc, k);
+    emit(cc, op);
+    stack_effect(cc, -2);
+    del_container(v);
+}
+
+/*
+    Compiles an S-Expression [or a Q-Expression treated as one, e.g. a body],
+    its children are moved into the chunk so a shared `v` is copied first
+*/
+static void compile_sexpr(Compiler_t* cc, Lval_t* v, bool tail) {
+    v = lval_unshare(v);
+    if (v->count == 0) {
+        v->type = LVAL_SEXPR;
+        emit(cc, OP_CONST);
+        emit(cc, add_const(cc, v));
+        stack_effect(cc, 1);
+        return;
+    }
+
+    if (v->count == 1) {
+        compile_expr(cc, v->cell[0], tail);
+        del_container(v);
+        return;
+    }
+
+    if (v->count == 4 && is_sym(v->cell[0], "if")
+        && v->cell[2]->type == LVAL_QEXPR && v->cell[3]->type == LVAL_QEXPR) {
+        compile_if(cc, v, tail);
+        return;
+    }
+
+    if (v->count == 2 && is_sym(v->cell[0], "eval")) {
+        compile_eval(cc, v, tail);
+        return;
+    }
+
+    if (v->count == 2 && is_sym(v->cell[0], "let")) {
+        compile_let(cc, v);
+        return;
+    }
+
+    if (v->count == 3 && (is_sym(v->cell[0], "&&") || is_sym(v->cell[0], "||"))) {
+        compile_logic(cc, v);
+        return;
+    }
+
+    if (v->count >= 2 && is_sym(v->cell[0], "select") && is_clauses(v, 1)) {
+        compile_select(cc, v, tail);
+        return;
+    }
+
+    if (v->count >= 3 && is_sym(v->cell[0], "case") && is_clauses(v, 2)) {
+        compile_case(cc, v, tail);
+        return;
+    }
+
+    int op = v->count == 3 ? binop_of(v->cell[0]) : -1;
+    if (op >= 0) {
+        compile_binop(cc, v, op);
+        return;
+    }
+
+    compile_expr(cc, v->cell[0], false);
+    compile_call(cc, v, tail);
+}
+
+/*
+    Compiles a single expression (e.g. a top-level form), takes ownership of `v`
+*/
+Lchunk_t* vm_compile(Lval_t* v) {
+    Compiler_t cc = { .chunk = chunk_new(), .depth = 0, .locals = NULL };
+    compile_expr(&cc, v, true);
+    emit(&cc, OP_RETURN);
+    return cc.chunk;
+}
+
+/*
+    Compiles the body of a function, which is evaluated as an S-Expression, the
+    function's own formals are read straight from the `locals` of its env
+*/
+Lchunk_t* vm_compile_body(Lval_t* body, Lenv_t* locals) {
+    Compiler_t cc = { .chunk = chunk_new(), .depth = 0, .locals = locals };
+    compile_sexpr(&cc, lval_ref(body), true);
+    emit(&cc, OP_RETURN);
+    return cc.chunk;
+}
+
+Lchunk_t* vm_chunk_ref(Lchunk_t* c) {
+    c->refs++;
+    return c;
+}
+
+/*
+    How many instructions `op` the code of `c` has [e.g. the quickened ones]
+*/
+int vm_chunk_ops(Lchunk_t* c, Opcode_e op) {
+    int n = 0;
+    for (int ip = 0; ip < c->count; ip += 1 + op_operands[c->code[ip]]) {
+        if (c->code[ip] == (int)op) n++;
+    }
+    return n;
+}
+
+void vm_chunk_del(Lchunk_t* c) {
+    if (--c->refs > 0) return;
+    for (int i = 0; i < c->n_consts; ++i) {
+        lval_del(c->consts[i]);
+    }
+    free(c->consts);
+    free(c->code);
+    free(c);
+}
+
+void vm_cleanup(void) {
+    for (int i = 0; i < EVAL_CACHE_SZ; ++i) {
+        if (eval_cache[i].key == NULL) continue;
+        lval_del(eval_cache[i].key);
+        vm_chunk_del(eval_cache[i].chunk);
+        eval_cache[i].key = NULL;
+    }
+    free(vm.stack);
+    free(vm.frames);
+}
+
+static void reserve_stack(Lchunk_t* chunk) {
+    if (vm.sp + chunk->max_stack > vm.stack_cap) {
+        while (vm.sp + chunk->max_stack > vm.stack_cap) {
+            vm.stack_cap = vm.stack_cap ? vm.stack_cap * 2 : VM_STACK_INIT;
+        }
+        vm.stack = realloc(vm.stack, sizeof(Lval_t*) * vm.stack_cap);
+    }
+}
+
+static Lval_t* too_deep(void) {
+    return lval_create_err("Recursion is too deep, more than [%i] nested calls", EVAL_MAX_DEPTH);
+}
+
+static void push_frame(Lval_t* fn, Lchunk_t* chunk, Lenv_t* env) {
+    if (vm.fp == vm.frames_cap) {
+        vm.frames_cap = vm.frames_cap ? vm.frames_cap * 2 : VM_FRAMES_INIT;
+        vm.frames = realloc(vm.frames, sizeof(Lframe_t) * vm.frames_cap);
+    }
+    reserve_stack(chunk);
+    vm.frames[vm.fp++] = (Lframe_t){ .fn = fn, .chunk = vm_chunk_ref(chunk), .env = env, .ip = 0 };
+}
+
+/*
+    Makes the current frame run `chunk` from the start, the frame's `fn`
+    [if any] is replaced by `fn` which then owns the env `env`
+*/
+static void reuse_frame(Lval_t* fn, Lchunk_t* chunk, Lenv_t* env) {
+    Lframe_t* f = &vm.frames[vm.fp - 1];
+    Lval_t* old_fn = f->fn;
+    Lchunk_t* old_chunk = f->chunk;
+    Lenv_t* old_scope = f->scope;
+
+    reserve_stack(chunk);
+    *f = (Lframe_t){ .fn = fn, .chunk = vm_chunk_ref(chunk), .env = env, .ip = 0 };
+
+    vm_chunk_del(old_chunk);
+    if (old_fn != NULL) lval_del(old_fn);
+    if (old_scope != NULL) lenv_del(old_scope);
+}
+
+/*
+    Enters the bound user-defined `fn` called from the env `e`. A tail call takes over
+    the caller's frame when nothing can still see the caller's env: the frame doesn't own
+    it [top-level or `eval`ed code], or the callee binds every symbol bound there
+    (e.g. a function calling itself) so under dynamic scoping the callee may skip it
+*/
+static void enter_fn(Lenv_t* e, Lval_t* fn, bool tail) {
+    Lframe_t* f = &vm.frames[vm.fp - 1];
+    Lenv_t* env = fn->func->env;
+
+    if (tail && f->fn == NULL && f->scope == NULL) {
+        env->parent = e;
+        reuse_frame(fn, fn->func->code, env);
+    } else if (tail && lenv_shadows(env, f->env)) {
+        env->parent = f->env->parent;
+        reuse_frame(fn, fn->func->code, env);
+    } else if (vm.fp < EVAL_MAX_DEPTH) {
+        env->parent = e;
+        push_frame(fn, fn->func->code, env);
+    } else {
+        lval_del(fn);
+        vm.stack[vm.sp++] = too_deep();
+    }
+}
+
+static Lval_t* eval_key(Lval_t* x) {
+    if (x->count == 1 && x->cell[0]->type == LVAL_SEXPR) return x->cell[0];
+    return x;
+}
+
+/* the cached code of `key`, compiled when it isn't there yet */
+static Lchunk_t* cached_chunk(Lval_t* key) {
+    int i = ((uintptr_t)key >> 3) & (EVAL_CACHE_SZ - 1);
+    if (eval_cache[i].key != key) {
+        if (eval_cache[i].key != NULL) {
+            lval_del(eval_cache[i].key);
+            vm_chunk_del(eval_cache[i].chunk);
+        }
+        eval_cache[i].key = lval_ref(key);
+        eval_cache[i].chunk = vm_compile_body(key, NULL);
+    }
+    return vm_chunk_ref(eval_cache[i].chunk);
+}
+
+/*
+    Code of the Q-Expression `x` evaluated as an S-Expression, consumes `x`. A shared expression
+    [a constant of some chunk, an element of a list] is a template that's likely evaluated again,
+    e.g. `st` evaluating the conditions of `select`, so its code is compiled once and cached.
+    The key is `x` itself, or its only element (`head` of a list gives a fresh `x` every time).
+*/
+static Lchunk_t* eval_chunk(Lval_t* x) {
+    Lval_t* key = eval_key(x);
+    if (lval_is_unique(x) && lval_is_unique(key)) {
+        x->type = LVAL_SEXPR;
+        return vm_compile(x);
+    }
+
+    Lchunk_t* chunk = cached_chunk(key);
+    lval_del(x);
+    return chunk;
+}
+
+/*
+    Code of the Q-Expression `x` evaluated as a body, `x` is left alone. The loops run it once
+    per iteration, and a shared one [a loop inside a function] goes through the `eval` cache
+    so that it's compiled once for all the runs of the loop, not once per run.
+*/
+Lchunk_t* vm_compile_shared(Lval_t* x) {
+    Lval_t* key = eval_key(x);
+    if (lval_is_unique(x) && lval_is_unique(key)) return vm_compile_body(x, NULL);
+    return cached_chunk(key);
+}
+
+/*
+    Evaluates the Q-Expression on top of the stack in the current env
+*/
+static void vm_eval(bool tail) {
+    Lval_t* x = vm.stack[vm.sp - 1];
+    if (x->type == LVAL_ERR) return;
+    if (x->type != LVAL_QEXPR) {
+        vm.stack[vm.sp - 1] = lval_create_err(
+            "Function `%s` expects arg of type %s. Arg [%i] is of type %s.",
+            "builtin_eval", ltype_name(LVAL_QEXPR), 1, ltype_name(x->type));
+        lval_del(x);
+        return;
+    }
+
+    vm.sp--;
+    Lchunk_t* chunk = eval_chunk(x);
+
+    Lframe_t* f = &vm.frames[vm.fp - 1];
+    if (tail) {  // same fn and env, only the code changes
+        reserve_stack(chunk);
+        vm_chunk_del(f->chunk);
+        f->chunk = chunk;
+        f->ip = 0;
+    } else if (vm.fp < EVAL_MAX_DEPTH) {
+        push_frame(NULL, chunk, f->env);
+        vm_chunk_del(chunk);
+    } else {
+        vm_chunk_del(chunk);
+        vm.stack[vm.sp++] = too_deep();
+    }
+}
+
+/*
+    Evaluates the Q-Expression on top of the stack in a new frame that owns a fresh scope,
+    whose parent is the current env, so that what `=` binds there goes away with the frame
+*/
+static void vm_let(void) {
+    Lval_t* x = vm.stack[vm.sp - 1];
+    if (x->type == LVAL_ERR) return;
+    if (x->type != LVAL_QEXPR) {
+        vm.stack[vm.sp - 1] = lval_create_err(
+            "Function `%s` expects arg of type %s. Arg [%i] is of type %s.",
+            "builtin_let", ltype_name(LVAL_QEXPR), 1, ltype_name(x->type));
+        lval_del(x);
+        return;
+    }
+    if (vm.fp >= EVAL_MAX_DEPTH) {
+        vm.stack[vm.sp - 1] = too_deep();
+        lval_del(x);
+        return;
+    }
+
+    vm.sp--;
+    Lchunk_t* chunk = eval_chunk(x);
+    Lenv_t* scope = lenv_new();
+    scope->parent = vm.frames[vm.fp - 1].env;
+    push_frame(NULL, chunk, scope);
+    vm.frames[vm.fp - 1].scope = scope;
+    vm_chunk_del(chunk);
+}
+
+/*
+    Applies `fn` to the `n` values on top of the stack, calls to user-defined functions
+    enter a frame instead of recursing, everything else pushes its result
+*/
+static void vm_call(Lenv_t* e, int n, bool tail) {
+    Lval_t** args = &vm.stack[vm.sp - n - 1];
+    vm.sp -= n + 1;
+
+    for (int i = 0; i <= n; ++i) {
+        if (args[i]->type == LVAL_ERR) {
+            Lval_t* err = args[i];
+            for (int j = 0; j <= n; ++j) {
+                if (j != i) lval_del(args[j]);
+            }
+            vm.stack[vm.sp++] = err;
+            return;
+        }
+    }
+
+    Lval_t* fn = args[0];
+    if (fn->type != LVAL_FN) {
+        Lval_t* err = lval_create_err(
+            "S-Expression must start with [%s] type. Got [%s]!",
+            ltype_name(LVAL_FN), ltype_name(fn->type));
+        for (int i = 0; i <= n; ++i) {
+            lval_del(args[i]);
+        }
+        vm.stack[vm.sp++] = err;
+        return;
+    }
+
+    Lval_t* a = lval_create_sexpr();
+    lval_cells_reserve(a, n);
+    a->count = n;
+    memcpy(a->cell, args + 1, sizeof(Lval_t*) * n);
+
+    if (fn->func->builtin != NULL || fn->func->is_extern || fn->func->code == NULL) {
+        Lval_t* res = lval_call(e, fn, a);
+        lval_del(fn);
+        vm.stack[vm.sp++] = res;
+        return;
+    }
+
+    lval_inline_refresh(fn->func);
+    fn = lval_unshare(fn);  // binding mutates it
+    Lval_t* err = lval_bind(e, fn, a);
+    if (err != NULL) {
+        lval_del(fn);
+        vm.stack[vm.sp++] = err;
+    } else if (fn->func->n_bound < fn->func->formals->count) {  // partially applied function
+        vm.stack[vm.sp++] = fn;
+    } else {
+        enter_fn(e, fn, tail);
+    }
+}
+
+/*
+    OP_BINOP's generic path: calls the builtin named by `sym` on the 2 topmost values
+*/
+static void binop_call(Lenv_t* e, Lval_t* sym) {
+    vm.stack[vm.sp] = vm.stack[vm.sp - 1];
+    vm.stack[vm.sp - 1] = vm.stack[vm.sp - 2];
+    vm.stack[vm.sp - 2] = lenv_get(e, sym);
+    vm.sp++;
+    vm_call(e, 2, false);
+}
+
+/*
+    OP_BINOP_INT's kernels, false when the builtin must handle it [a division by 0],
+    a comparison gives 0 or 1
+*/
+static bool binop_int(int op, long x, long y, long* res) {
+    switch (op) {
+        case BINOP_ADD: *res = x + y; return true;
+        case BINOP_SUB: *res = x - y; return true;
+        case BINOP_MUL: *res = x * y; return true;
+        case BINOP_DIV: if (y == 0) return false; *res = x / y; return true;
+        case BINOP_MOD: if (y == 0) return false; *res = x % y; return true;
+        case BINOP_GT:  *res = x > y;  return true;
+        case BINOP_LT:  *res = x < y;  return true;
+        case BINOP_GE:  *res = x >= y; return true;
+        case BINOP_LE:  *res = x <= y; return true;
+        case BINOP_EQ:  *res = x == y; return true;
+        case BINOP_NE:  *res = x != y; return true;
+        default:
+            fprintf(stderr, "You added a new binop, but forgot to add it to %s!\n", __func__);
+            assert(false);
+    }
+}
+
+/*
+    Runs `c` in the environment `e` until it returns, calls between user-defined
+    functions only grow the (heap allocated) frames, a nested run [e.g. from a
+    builtin calling back into the VM] recurses in C
+*/
+Lval_t* vm_run(Lenv_t* e, Lchunk_t* c) {
+    if (vm.fp >= EVAL_MAX_DEPTH) return too_deep();
+    Lval_t* err = eval_stack_check();
+    if (err != NULL) return err;
+
+    int base = vm.fp;
+    push_frame(NULL, c, e);
+
+    for (;;) {
+        Lframe_t* f = &vm.frames[vm.fp - 1];
+        int* code = f->chunk->code;
+
+        switch (code[f->ip++]) {
+            case OP_CONST: {
+                vm.stack[vm.sp++] = lval_ref(f->chunk->consts[code[f->ip++]]);
+                break;
+            }
+
+            case OP_LOAD: {
+                vm.stack[vm.sp++] = lenv_get(f->env, f->chunk->consts[code[f->ip++]]);
+                break;
+            }
+
+            case OP_LOCAL: {
+                vm.stack[vm.sp++] = lval_ref(f->env->locals[code[f->ip++]]);
+                break;
+            }
+
+            case OP_CALL:
+            case OP_TAIL_CALL: {
+                bool tail = code[f->ip - 1] == OP_TAIL_CALL;
+                int n = code[f->ip++];
+                vm_call(f->env, n, tail);
+                break;
+            }
+
+            case OP_EVAL:
+            case OP_TAIL_EVAL: {
+                vm_eval(code[f->ip - 1] == OP_TAIL_EVAL);
+                break;
+            }
+
+            case OP_LET: {
+                vm_let();
+                break;
+            }
+
+            /*
+                Quickening: a site starts generic and becomes OP_BINOP_INT once it sees two
+                integers. If that ever sees other types it turns into OP_BINOP_ANY for good,
+                so a site that mixes types [shared by every copy of the function] doesn't
+                keep rewriting itself. A division by 0 stays quickened, the builtin reports it.
+            */
+            case OP_BINOP: {
+                Lval_t* sym = f->chunk->consts[code[f->ip++]];
+                f->ip++;
+                if (vm.stack[vm.sp - 2]->type == LVAL_INTEGER && vm.stack[vm.sp - 1]->type == LVAL_INTEGER) {
+                    code[f->ip - 3] = OP_BINOP_INT;  // the next runs expect integers
+                }
+                binop_call(f->env, sym);
+                break;
+            }
+
+            case OP_BINOP_ANY: {
+                Lval_t* sym = f->chunk->consts[code[f->ip]];
+                f->ip += 2;
+                binop_call(f->env, sym);
+                break;
+            }
+
+            case OP_BINOP_INT: {
+                Lval_t* x = vm.stack[vm.sp - 2];
+                Lval_t* y = vm.stack[vm.sp - 1];
+                if (x->type != LVAL_INTEGER || y->type != LVAL_INTEGER) {  // runs right away as generic
+                    code[--f->ip] = OP_BINOP_ANY;
+                    break;
+                }
+
+                int op = code[f->ip + 1];
+                long res;
+                if (!binop_int(op, x->num.li, y->num.li, &res)) {
+                    binop_call(f->env, f->chunk->consts[code[f->ip]]);
+                    f->ip += 2;
+                    break;
+                }
+                lval_del(x);
+                lval_del(y);
+                vm.sp -= 2;
+                f->ip += 2;
+                if (code[f->ip] == OP_BRANCH) {  // the condition of an `if`, branch on it right away
+                    f->ip = res != 0 ? f->ip + 3 : code[f->ip + 1];
+                    break;
+                }
+                vm.stack[vm.sp++] = op >= BINOP_GT ? lval_create_bool(res) : lval_create_long(res);
+                break;
+            }
+
+            case OP_BRANCH: {
+                int else_at = code[f->ip++];
+                int end_at = code[f->ip++];
+                Lval_t* cond = vm.stack[vm.sp - 1];
+
+                if (cond->type == LVAL_ERR) {
+                    f->ip = end_at;
+                    break;
+                }
+
+                bool truth;
+                if      (cond->type == LVAL_DECIMAL) truth = (long)cond->num.f != 0;
+                else if (cond->type == LVAL_INTEGER) truth = cond->num.li != 0;
+                else if (cond->type == LVAL_BOOL)    truth = cond->num.li != 0;
+                else {
+                    vm.stack[vm.sp - 1] = lval_create_err(
+                        "Function `%s` expects arg of type %s. Arg [%i] is of type %s.",
+                        "builtin_if", ltype_name(LVAL_BOOL), 1, ltype_name(cond->type));
+                    lval_del(cond);
+                    f->ip = end_at;
+                    break;
+                }
+
+                lval_del(cond);
+                vm.sp--;
+                if (!truth) f->ip = else_at;
+                break;
+            }
+
+            case OP_DROP: {
+                int end_at = code[f->ip++];
+                Lval_t* x = vm.stack[vm.sp - 1];
+                if (x->type == LVAL_ERR) {
+                    f->ip = end_at;
+                } else {
+                    lval_del(x);
+                    vm.sp--;
+                }
+                break;
+            }
+
+            case OP_LOGIC: {
+                bool or = code[f->ip++];
+                int end_at = code[f->ip++];
+                Lval_t* x = vm.stack[vm.sp - 1];
+                bool truth;
+                Lval_t* res = lval_logic_operand(x, or, 1, &truth);
+                lval_del(x);
+                if (res == NULL && truth != or) {
+                    vm.sp--;
+                    break;
+                }
+                vm.stack[vm.sp - 1] = res != NULL ? res : lval_create_bool(truth);
+                f->ip = end_at;
+                break;
+            }
+
+            case OP_TRUTH: {
+                bool or = code[f->ip++];
+                Lval_t* x = vm.stack[vm.sp - 1];
+                bool truth;
+                Lval_t* res = lval_logic_operand(x, or, 2, &truth);
+                vm.stack[vm.sp - 1] = res != NULL ? res : lval_create_bool(truth);
+                lval_del(x);
+                break;
+            }
+
+            case OP_MATCH: {
+                int else_at = code[f->ip++];
+                int end_at = code[f->ip++];
+                Lval_t* k = vm.stack[--vm.sp];
+                Lval_t* x = vm.stack[vm.sp - 1];
+                if (x->type == LVAL_ERR || k->type == LVAL_ERR) {  // the error of the value to match first
+                    if (x->type == LVAL_ERR) {
+                        lval_del(k);
+                    } else {
+                        lval_del(x);
+                        vm.stack[vm.sp - 1] = k;
+                    }
+                    f->ip = end_at;
+                    break;
+                }
+
+                bool match = lval_eq(x, k);
+                lval_del(k);
+                if (match) {
+                    lval_del(x);
+                    vm.sp--;
+                } else {
+                    f->ip = else_at;
+                }
+                break;
+            }
+
+            case OP_JUMP: {
+                f->ip = code[f->ip];
+                break;
+            }
+
+            case OP_RETURN: {
+                Lval_t* res = vm.stack[--vm.sp];
+                vm.fp--;
+                vm_chunk_del(f->chunk);
+                if (f->fn != NULL) lval_del(f->fn);
+                if (f->scope != NULL) lenv_del(f->scope);
+                if (vm.fp == base) return res;
+                vm.stack[vm.sp++] = res;
+                break;
+            }
+
+            default:
+                fprintf(stderr, "You added a new opcode, but forgot to add it to %s!\n", __func__);
+                assert(false);
+        }
+    }
+}
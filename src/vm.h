@@ -0,0 +1,63 @@
+#pragma once
+#include "core.h"
+
+/*
+    Bytecode for the bodies of user-defined functions and top-level forms.
+    Every instruction is one `int` opcode followed by its `int` operands.
+*/
+typedef enum {
+    OP_CONST,   // [k]          push (a reference to) the constant `k`
+    OP_LOAD,    // [k]          push the value bound to the symbol constant `k`
+    OP_LOCAL,   // [i]          push the value of the `i`th local of the function's env (see Lenv_t)
+    OP_CALL,    // [n]          apply the value below the `n` topmost values to them
+    OP_TAIL_CALL,   // [n]      same as OP_CALL for a call whose value is returned, may reuse the frame
+    OP_BINOP,   // [k, op]      apply the arithmetic/comparison builtin `op` [named by the symbol constant `k`] to the 2 topmost values
+    OP_BINOP_INT,   // [k, op]  OP_BINOP quickened after it saw two integers, it turns into OP_BINOP_ANY when it doesn't
+    OP_BINOP_ANY,   // [k, op]  OP_BINOP at a site that saw other types, always generic so it never flips back and forth
+    OP_EVAL,    //              pop a Q-Expression and evaluate it in a new frame sharing the current env
+    OP_TAIL_EVAL,   //          same as OP_EVAL, in place of the current frame
+    OP_LET,     //              pop a Q-Expression and evaluate it in a new frame with a scope of its own
+    OP_DROP,    // [end]        pop and discard the top, unless it's an error which is kept for a jump to `end`
+    OP_BRANCH,  // [else, end]  pop an `if` condition, jump to `else` when false (to `end` on error)
+    OP_LOGIC,   // [or, end]    pop the left operand of `&&` [`||` if `or`], jump to `end` with the result when it decides it
+    OP_TRUTH,   // [or]         turn the right operand of `&&` [`||` if `or`] on the top into the result
+    OP_MATCH,   // [else, end]  pop a `case` value, pop the matched value below it if they're equal, otherwise jump to `else`
+    OP_JUMP,    // [addr]       unconditional jump
+    OP_RETURN,  //              return the top of the stack to the caller
+} Opcode_e;
+
+/*
+    The builtins that OP_BINOP applies, a call site of one of them with 2 args compiles to OP_BINOP
+*/
+typedef enum {
+    BINOP_ADD,
+    BINOP_SUB,
+    BINOP_MUL,
+    BINOP_DIV,
+    BINOP_MOD,
+    BINOP_GT,  // the comparisons [from here on] give booleans
+    BINOP_LT,
+    BINOP_GE,
+    BINOP_LE,
+    BINOP_EQ,
+    BINOP_NE,
+} Binop_e;
+
+struct Lchunk_t {
+    int refs;  // shared by all the copies of a function
+    int* code;
+    int count;
+    int capacity;
+    Lval_t** consts;
+    int n_consts;
+    int max_stack;  // deepest the value stack can get while running this chunk
+};
+
+Lchunk_t* vm_compile(Lval_t* v);
+Lchunk_t* vm_compile_body(Lval_t* body, Lenv_t* locals);
+Lchunk_t* vm_compile_shared(Lval_t* x);
+Lchunk_t* vm_chunk_ref(Lchunk_t* c);
+int       vm_chunk_ops(Lchunk_t* c, Opcode_e op);
+void      vm_chunk_del(Lchunk_t* c);
+Lval_t*   vm_run(Lenv_t* e, Lchunk_t* c);
+void      vm_cleanup(void);
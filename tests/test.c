@@ -5,6 +5,7 @@
 
 #include "../src/lang.h"
 #include "../src/core.h"
+#include "../src/vm.h"
 
 #define PRINT_VERDICT(cond, name) (printf("[%s] [Test %s]\n", (cond) ? "PASSED" : "FAILED", (name)))
 
@@ -14,6 +15,8 @@ typedef struct {
     Lval_t expected;
     char* fn;
     bool dont_eval;
+    char* body_of;  // a function whose body must no longer mention any of the symbols
+    char* body_lacks;  // [separated by spaces] of `body_lacks` once `.fn` ran
 } test_statement_t;
 
 
@@ -91,6 +94,18 @@ static void assert_equal(Lval_t* val, Lval_t expected, char* test_name) {
   }
 }
 
+/*
+    Whether the symbol `sym` occurs anywhere in `v`
+*/
+static bool lval_mentions(Lval_t* v, char* sym) {
+    if (v->type == LVAL_SYM) return strcmp(v->sym, sym) == 0;
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) return false;
+    for (int i = 0; i < v->count; ++i) {
+        if (lval_mentions(v->cell[i], sym)) return true;
+    }
+    return false;
+}
+
 static Lval_t get_lval_err(char* msg) {
     return (Lval_t){
         .type = LVAL_ERR,
@@ -221,6 +236,27 @@ static void test_all_operators(mpc_parser_t* language, Lenv_t* e) {
     }
 }
 
+static void test_decimal_operators(mpc_parser_t* language, Lenv_t* e) {
+    test_statement_t t = {
+        .name = "decimal operators",
+        .statement = "+ (* 1.5 2) (/ 7 2.) (% 7.5 2) (- 2.5) (^ 4. .5)",
+        .expected = get_lval_double(7.5),
+    };
+
+    mpc_result_t r;
+    if (mpc_parse("test", t.statement, language, &r)) {
+        Lval_t* res = lval_eval(e, lval_read(r.output));
+        assert_equal(res, t.expected, t.name);
+        mpc_ast_delete(r.output);
+    } else {
+        printf("[FAILED] Parsing error\n");
+        PRINT_VERDICT(false, t.name);
+#ifdef EXIT_ON_FAIL
+        exit(1);
+#endif
+    }
+}
+
 static void test_min_max(mpc_parser_t* language, Lenv_t* e) {
     test_statement_t t = {
         .name = "min max",
@@ -265,6 +301,21 @@ static void test_QExpressions(mpc_parser_t* language, Lenv_t* e) {
             .statement = "eval (head {(+ 1 2) (+ 10 20)})",
             .expected = get_lval_long(3)
         },
+        {
+            .name = "QExpressions eval shared expression twice",
+            .statement = "do (def {qx} 1) (def {qe} {+ qx 1}) (def {q1} (eval qe)) (def {qx} 5) (+ q1 (eval qe) (eval (head {(+ qx 1)})))",
+            .expected = get_lval_long(14)
+        },
+        {
+            .name = "QExpressions slices leave the list intact",
+            .statement = "do (def {ql} {1 2 3 4}) (def {qt} (tail (tail ql))) (def {qh} (head qt)) (+ (len ql) (len (join qt {5})) (eval (join {+} qh qt)) (len ql))",
+            .expected = get_lval_long(21)
+        },
+        {
+            .name = "QExpressions rebinding keeps aliases intact",
+            .statement = "do (def {qa} {1 2 3}) (def {qb qa} qa (join qa {4})) (= {qb} qb) (+ (len qa) (len qb) (nth 2 qb))",
+            .expected = get_lval_long(10)
+        },
 
         // keep this at the end
         {.statement = "end"},
@@ -348,6 +399,11 @@ static void test_Boolean(mpc_parser_t* language, Lenv_t* e) {
             .statement = "|| (&& 0 false) (! true)",
             .expected = get_lval_bool(false)
         },
+        {
+            .name = "Boolean `!` on numbers",
+            .statement = "+ (! 0) (! 2.5) (! 0)",
+            .expected = get_lval_long(2)
+        },
 
         // keep this at the end
         {.statement = "end"},
@@ -387,6 +443,16 @@ static void test_Builtin_Symbol_Redefinition_Error(mpc_parser_t* language, Lenv_
             .statement = "def {fn} true",
             .expected = get_lval_err("")
         },
+        {
+            .name = "Builtin_Symbol_Redefinition_Error `if` as lambda arg",
+            .statement = "(\\ {if} {if}) 1",
+            .expected = get_lval_err("")
+        },
+        {
+            .name = "Builtin_Symbol_Redefinition_Error `len`",
+            .statement = "fn {len l} {0}",
+            .expected = get_lval_err("")
+        },
 
         // keep this at the end
         {.statement = "end"},
@@ -441,6 +507,31 @@ static void test_StdLib(mpc_parser_t* language, Lenv_t* e) {
             .statement = "nd (map - {.4 5 6 7 8})",
             .expected = get_lval_long(-5)
         },
+        {
+            .name = "StdLib `len/nth/last`",
+            .statement = "+ (len {1 2 3}) (len \"ab\") (nth 1 {4 5 6}) (last {4 5 6})",
+            .expected = get_lval_long(16)
+        },
+        {
+            .name = "StdLib `take/drop/foldl`",
+            .statement = "foldl (\\ {z x} {+ (* z 10) x}) 0 (join (take 2 {1 2 3 4}) (drop 3 {1 2 3 4}))",
+            .expected = get_lval_long(124)
+        },
+        {
+            .name = "StdLib `let`",
+            .statement = "let {do (= {lt_v} 5) (+ lt_v 1)}",
+            .expected = get_lval_long(6)
+        },
+        {
+            .name = "StdLib `let` scope is gone afterwards",
+            .statement = "lt_v",
+            .expected = get_lval_err("")
+        },
+        {
+            .name = "StdLib `nth` out of bounds",
+            .statement = "nth 3 {1 2 3}",
+            .expected = get_lval_err("")
+        },
 
         // keep this at the end
         {.statement = "end"},
@@ -525,6 +616,56 @@ static void test_Conditional(mpc_parser_t* language, Lenv_t* e) {
             .statement = "if (== exit true) {+ 666 0} {* 1. .5}",
             .expected = get_lval_double(0.5)
         },
+        {
+            .name = "Conditional && and || short-circuit",
+            .statement = "if (|| true (error \"no\")) {&& false (error \"no\")} {1}",
+            .expected = get_lval_bool(false)
+        },
+        {
+            .name = "Conditional select stops at the first true clause",
+            .statement = "select {(> 1 2) (error \"no\")} {otherwise (+ 1 2)} {true (error \"no\")}",
+            .expected = get_lval_long(3)
+        },
+        {
+            .name = "Conditional case stops at the first match",
+            .statement = "case 2 {1 (error \"no\")} {(+ 1 1) 20} {2 (error \"no\")}",
+            .expected = get_lval_long(20)
+        },
+        {
+            .name = "Conditional case without a match",
+            .statement = "case 3 {1 10} {2 20}",
+            .expected = get_lval_err("")
+        },
+        {
+            .name = "Conditional select given computed clauses",
+            .statement = "unpack select (list {false 1} {true 2})",
+            .expected = get_lval_long(2)
+        },
+        {
+            .name = "Conditional while",
+            .statement = "do (def {lp_n} 0) (while {< lp_n 5} {= {lp_n} (+ lp_n 1)}) (lp_n)",
+            .expected = get_lval_long(5)
+        },
+        {
+            .name = "Conditional dotimes",
+            .statement = "do (def {lp_acc} 0) (dotimes {i} 101 {= {lp_acc} (+ lp_acc i)}) (lp_acc)",
+            .expected = get_lval_long(5050)
+        },
+        {
+            .name = "Conditional for-each",
+            .statement = "do (def {lp_s} \"\") (for-each {x} {\"a\" \"b\"} {= {lp_s} (join lp_s x)}) (lp_s)",
+            .expected = get_lval_str("ab")
+        },
+        {
+            .name = "Conditional loop stops at an error",
+            .statement = "dotimes {i} 10 {if (== i 3) {error \"three\"} {i}}",
+            .expected = get_lval_err("")
+        },
+        {
+            .name = "Conditional loop inside a fn runs again",
+            .statement = "do (fn {lp_tri n} {do (= {t} 0) (dotimes {i} n {= {t} (+ t i)}) t}) (+ (lp_tri 4) (lp_tri 5) (lp_tri 101))",
+            .expected = get_lval_long(5066)
+        },
 
         // keep this at the end
         {.statement = "end"},
@@ -743,6 +884,120 @@ static void test_fn(mpc_parser_t* language, Lenv_t* e) {
             .expected = get_lval_long(4),
             .fn = "fn {add a b} {+ a b}"
         },
+        {
+            .name = "fn shared list is not mutated",
+            .statement = "tail_len {1 2 3}",
+            .expected = get_lval_long(5),
+            .fn = "fn {tail_len l} {+ (len (tail l)) (len l)}"
+        },
+        {
+            .name = "fn tail call",
+            .statement = "count_down 5000",
+            .expected = get_lval_long(0),
+            .fn = "fn {count_down n} {if (== n 0) {n} {count_down (- n 1)}}"
+        },
+        {
+            .name = "fn deep recursion",
+            .statement = "count_up 3000",
+            .expected = get_lval_long(3000),
+            .fn = "fn {count_up n} {if (== n 0) {0} {+ 1 (count_up (- n 1))}}"
+        },
+        {
+            .name = "fn formal rebound with `=`",
+            .statement = "rebind 4",
+            .expected = get_lval_long(10),
+            .fn = "fn {rebind x} {do (= {x} (+ x 1)) (* x 2)}"
+        },
+        {
+            .name = "fn global redefined, then shadowed by a formal",
+            .statement = "do (def {gx} 1) (def {g1} (read_gx 0)) (fn {shadow_gx gx} {read_gx 0}) (def {gx} 10) (+ g1 (read_gx 0) (shadow_gx 7))",
+            .expected = get_lval_long(18),
+            .fn = "fn {read_gx _} {gx}"
+        },
+        {
+            .name = "fn partial application is shared",
+            .statement = "do (def {add3_1} (add3 1)) (+ (add3_1 2 3) ((add3_1 10) 20))",
+            .expected = get_lval_long(37),
+            .fn = "fn {add3 a b c} {+ a b c}"
+        },
+        {
+            .name = "fn quickened op given decimals",
+            .statement = "+ (qdiv 7 2) (qdiv 7.0 2) (qdiv 9 3)",
+            .expected = get_lval_double(9.5),
+            .fn = "fn {qdiv a b} {/ a b}"
+        },
+        {
+            .name = "fn quickened op dividing by 0",
+            .statement = "+ (qmod 7 2) (qmod 7 0)",
+            .expected = get_lval_err(""),
+            .fn = "fn {qmod a b} {% a b}"
+        },
+        {
+            .name = "fn literal arithmetic folded at load",
+            .statement = "fold_center 10",
+            .expected = get_lval_long(320),
+            .fn = "load \"./tests/fold.pkl\"",
+            .body_of = "fold_center",
+            .body_lacks = "/",
+        },
+        {
+            .name = "fn literal arithmetic folded into `select` clauses",
+            .statement = "+ (fold_pick 10) (fold_pick 470)",
+            .expected = get_lval_long(3),
+            .fn = "load \"./tests/fold.pkl\"",
+            .body_of = "fold_pick",
+            .body_lacks = "-",
+        },
+        {
+            .name = "fn folding leaves errors to runtime",
+            .statement = "+ (fold_div 2) (fold_div 0)",
+            .expected = get_lval_err(""),
+            .fn = "load \"./tests/fold.pkl\"",
+        },
+        {
+            .name = "fn inlined callee",
+            .statement = "inl_sq 3",
+            .expected = get_lval_long(9),
+            .fn = "fn {inl_sq x} {* x x}"
+        },
+        {
+            .name = "fn calls inlined",
+            .statement = "inl_sum_sq 3 4",
+            .expected = get_lval_long(25),
+            .fn = "fn {inl_sum_sq a b} {+ (inl_sq a) (inl_sq b)}"
+        },
+        {
+            .name = "fn inlined callee redefined",
+            .statement = "inl_sum_sq 3 4",
+            .expected = get_lval_long(14),
+            .fn = "fn {inl_sq x} {+ x x}"
+        },
+        {
+            .name = "fn inlined callee shadowed by a formal",
+            .statement = "inl_apply (\\ {x} {* 10 x}) 2",
+            .expected = get_lval_long(40),
+            .fn = "fn {inl_apply inl_sq v} {inl_sum_sq v v}"
+        },
+        {
+            .name = "fn stdlib helpers inlined",
+            .statement = "+ (inl_pick {1 2 3}) (inl_pick {10 20 30})",
+            .expected = get_lval_long(135),
+            .fn = "fn {inl_pick l} {if (not (and (> (st l) 5) true)) {nd l} {+ (rd l) (swap - (comp - len l) 100)}}",
+            .body_of = "inl_pick",
+            .body_lacks = "st nd rd not and swap comp",
+        },
+        {
+            .name = "fn callee reading a formal of its caller",
+            .statement = "do (fn {inl_f3 x} {inl_k 1}) (fn {inl_h3 y} {inl_f3 y}) (inl_h3 5)",
+            .expected = get_lval_long(6),
+            .fn = "fn {inl_k z} {+ z x}"
+        },
+        {
+            .name = "fn callee evaluating data that names its formal",
+            .statement = "len (inl_sees_l 0)",
+            .expected = get_lval_long(1),
+            .fn = "fn {inl_sees_l x} {st {l}}"
+        },
         // keep this at the end
         {.statement = "end"},
     };
@@ -778,6 +1033,28 @@ static void test_fn(mpc_parser_t* language, Lenv_t* e) {
             exit(1);
 #endif
         }
+
+        /*
+            STEP THREE: check what the `.fn` custom function's body was rewritten to
+        */
+        if (tests[i].body_of != NULL && mpc_parse("test", tests[i].body_of, language, &r)) {
+            Lval_t* fn = lval_eval(e, lval_read(r.output));
+            bool cond = fn->type == LVAL_FN;
+            char syms[128];
+            strncpy(syms, tests[i].body_lacks, sizeof(syms) - 1);
+            syms[sizeof(syms) - 1] = '\0';
+            for (char* sym = strtok(syms, " "); sym != NULL && cond; sym = strtok(NULL, " ")) {
+                cond = !lval_mentions(fn->func->body, sym);
+            }
+            char name[128];
+            snprintf(name, sizeof(name), "%s, body", tests[i].name);
+            PRINT_VERDICT(cond, name);
+            lval_del(fn);
+#ifdef EXIT_ON_FAIL
+            if (!cond) exit(-1);
+#endif
+            mpc_ast_delete(r.output);
+        }
         i++;
     }
 }
@@ -861,6 +1138,44 @@ static void test_syntax_err(mpc_parser_t* language, Lenv_t* e) {
     }
 }
 
+#ifndef TREE_WALKER
+/*
+    The call sites of a function's chunk quicken on integers, and stay generic once they saw other types
+*/
+static void test_Quickening(mpc_parser_t* language, Lenv_t* e) {
+    test_statement_t t = {
+        .name = "Quickening",
+        .statement = "do (fn {qk_f a b} {if (> a b) {- a b} {+ a b}}) (qk_f 5 3) (qk_f 1 2) (qk_f 1.5 2) (qk_f 5 3)",
+        .expected = get_lval_long(2),
+    };
+
+    mpc_result_t r;
+    if (mpc_parse("test", t.statement, language, &r)) {
+        Lval_t* res = lval_eval(e, lval_read(r.output));
+        assert_equal(res, t.expected, t.name);
+        mpc_ast_delete(r.output);
+    }
+    if (mpc_parse("test", "qk_f", language, &r)) {
+        Lval_t* fn = lval_eval(e, lval_read(r.output));
+        Lchunk_t* code = fn->func->code;
+        bool cond = vm_chunk_ops(code, OP_BINOP_INT) == 1    // `-` only saw integers
+            && vm_chunk_ops(code, OP_BINOP_ANY) == 2         // `>` and `+` saw a decimal
+            && vm_chunk_ops(code, OP_BINOP) == 0;
+        PRINT_VERDICT(cond, "Quickening sites");
+#ifdef EXIT_ON_FAIL
+        if (!cond) exit(-1);
+#endif
+        mpc_ast_delete(r.output);
+    } else {
+        printf("[FAILED] Parsing error\n");
+        PRINT_VERDICT(false, t.name);
+#ifdef EXIT_ON_FAIL
+        exit(1);
+#endif
+    }
+}
+#endif
+
 int main() {
 
     mpc_parser_t* language = NULL;
@@ -871,6 +1186,7 @@ int main() {
     test_decimal_addition(language, e);
     test_heterogenous_addition(language, e);
     test_all_operators(language, e);
+    test_decimal_operators(language, e);
     test_min_max(language, e);
     test_DivByZero_err(language, e);
     test_BadInput_err(language, e);
@@ -888,6 +1204,9 @@ int main() {
     // keep last since these tetst register functions into the language instance
     test_ExternDLL(language, e);
     test_fn(language, e); 
+#ifndef TREE_WALKER
+    test_Quickening(language, e);
+#endif
 
     cleanup();
     lenv_del(e);